@@ -5,6 +5,7 @@
 #include "KeyCode.hpp"
 #include "WindowUtils.hpp"
 #include "StringUtils.hpp"
+#include "TimeUtils.hpp"
 #include "Log.h"
 
 #include <algorithm>
@@ -14,6 +15,9 @@ static IMenu* consoleMenu = NULL;
 
 std::unordered_map<std::string/* name */, std::function<void(std::vector<std::string>)>/* func */> ConsoleCommandRunner::customCmdList;
 
+std::mutex ConsoleCommandRunner::windowCacheLock;
+std::unordered_map<std::string/* title */, ConsoleCommandRunner::CachedWindow> ConsoleCommandRunner::windowCache;
+
 void ConsoleCommandRunner::RunCommand(std::string command) {
 	if (!consoleMenu) {
 		Log::info("Trying to create Console menu");
@@ -184,22 +188,14 @@ void ConsoleCommandRunner::CustomCommandSleep(std::vector<std::string> params) {
 	}
 }
 
-void ConsoleCommandRunner::CustomCommandSwitchWindow(std::vector<std::string> params) {
+HWND ConsoleCommandRunner::FindWindowByTitle(const std::string &windowTitle) {
 	HWND window = NULL;
 	DWORD pid = 0;
-	std::string windowTitle;
 
-	if (params.size() < 2) {
+	if (windowTitle.empty()) {
 		pid = GetCurrentProcessId();
 	}
 	else {
-		windowTitle = params[1];
-		for (size_t i = 2; i < params.size(); i++) {
-			windowTitle += ' ';
-			windowTitle += params[i];
-		}
-		//Log::info("title: " + windowTitle);
-
 		pid = GetProcessIDByName(windowTitle.c_str());
 	}
 
@@ -218,8 +214,69 @@ void ConsoleCommandRunner::CustomCommandSwitchWindow(std::vector<std::string> pa
 		}
 	}
 
+	return window;
+}
+
+HWND ConsoleCommandRunner::GetCachedWindow(const std::string &windowTitle, bool *isCached) {
+	std::string key = windowTitle;
+	stringToLower(key);
+
+	if (isCached) {
+		*isCached = false;
+	}
+
+	std::lock_guard<std::mutex> scopeLock(windowCacheLock);
+
+	auto itr = windowCache.find(key);
+	if (itr != windowCache.end()) {
+		// The window may be closed, or its handle reused by another process
+		DWORD pid = 0;
+		if (IsWindow(itr->second.window) && GetWindowThreadProcessId(itr->second.window, &pid) && pid == itr->second.pid) {
+			if (isCached) {
+				*isCached = true;
+			}
+			return itr->second.window;
+		}
+		windowCache.erase(itr);
+	}
+
+	HWND window = FindWindowByTitle(windowTitle);
+	if (window != NULL) {
+		CachedWindow cachedWindow = { window, 0 };
+		GetWindowThreadProcessId(window, &cachedWindow.pid);
+		windowCache[key] = cachedWindow;
+	}
+	return window;
+}
+
+void ConsoleCommandRunner::ResolveSkyrimWindow() {
+	if (GetCachedWindow("") != NULL) {
+		Log::info("Skyrim window resolved");
+	}
+	else {
+		Log::info("Cannot resolve Skyrim window, will retry when switchwindow is called");
+	}
+}
+
+void ConsoleCommandRunner::CustomCommandSwitchWindow(std::vector<std::string> params) {
+	UInt64 beginTime = GetTimeMicroseconds();
+	std::string windowTitle;
+
+	if (params.size() >= 2) {
+		windowTitle = params[1];
+		for (size_t i = 2; i < params.size(); i++) {
+			windowTitle += ' ';
+			windowTitle += params[i];
+		}
+		//Log::info("title: " + windowTitle);
+	}
+
+	bool isCached = false;
+	HWND window = GetCachedWindow(windowTitle, &isCached);
+
 	if (window != NULL) {
 		SwitchToThisWindow(window, true);
+		Log::info("switchwindow " + windowTitle + ": " + std::to_string(GetTimeMicroseconds() - beginTime) + "us" + (isCached ? " (cached)" : ""));
 	}
 	else {
 		Log::info("Cannot find windows with title/executable: " + windowTitle);
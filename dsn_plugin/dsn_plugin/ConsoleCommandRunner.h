@@ -16,6 +16,19 @@ private:
 
 	static std::unordered_map<std::string/* name */, std::function<void(std::vector<std::string>)>/* func */> customCmdList;
 
+	struct CachedWindow {
+		HWND window;
+		DWORD pid;
+	};
+
+	// Resolved windows of the switchwindow command, the key is the lower case title/executable name.
+	// The Skyrim main window uses an empty key.
+	static std::mutex windowCacheLock;
+	static std::unordered_map<std::string/* title */, CachedWindow> windowCache;
+
+	// Search the main window by title/executable name, an empty title means the Skyrim window.
+	static HWND FindWindowByTitle(const std::string &windowTitle);
+
 public:
 	// Run a Skyrim console command
 	static void RunCommand(std::string command);
@@ -28,6 +41,12 @@ public:
 	// should add the command to another queue.
 	static bool TryRunCustomCommand(const std::string &command);
 
+	// Resolve the Skyrim main window once, so switchwindow without parameters doesn't need to search for it.
+	static void ResolveSkyrimWindow();
+	// Get the window from cache, or search and cache it if it's missing or no longer valid.
+	// isCached will be set to true if the window is returned from cache.
+	static HWND GetCachedWindow(const std::string &windowTitle, bool *isCached = NULL);
+
 	//
 	// Add a new command:
 	//         press <key name or DirectInput scan code> [millisecond] ...
@@ -135,6 +154,8 @@ public:
 	//         Activate the specified window.
 	//         Used to switch to the correct window before running the press command.
 	//         Omitting the parameters will activate the current Skyrim window.
+	//         Found windows are cached until they are closed, so repeated switching
+	//         doesn't need to walk all processes and windows again.
 	//
 	// TODO:
 	//         Move the mouse cursor to the center of the active window.
@@ -1,13 +1,242 @@
 #include "Equipper.h"
 #include "Log.h"
 
-bool Equipper::CanEquipBothHands(Actor* actor, TESForm * item)
+std::mutex Equipper::metadataLock;
+std::unordered_map<UInt32 /* formId */, EquipMetadata> Equipper::metadataCache;
+std::mutex Equipper::inventoryLock;
+ExtraContainerChanges::Data * Equipper::indexedContainer = NULL;
+TESContainer * Equipper::indexedBaseContainer = NULL;
+std::unordered_map<UInt32 /* formId */, InventoryBaseEntry> Equipper::inventoryBaseIndex;
+std::unordered_map<UInt32 /* formId */, std::unordered_map<SInt32 /* itemId */, InventoryIndexEntry>> Equipper::inventoryIndex;
+
+static EquipMetadata ResolveEquipMetadata(TESForm * item)
 {
+	EquipMetadata metadata = { item, kEquipKind_Other, NULL, false, 0, false };
+
+	if (TESObjectWEAP * weapon = DYNAMIC_CAST(item, TESForm, TESObjectWEAP))
+	{
+		metadata.kind = kEquipKind_Weapon;
+		UInt8 type = weapon->type();
+		metadata.isTwoHanded = type == TESObjectWEAP::GameData::kType_TwoHandSword || type == TESObjectWEAP::GameData::kType_TwoHandAxe ||
+			type == TESObjectWEAP::GameData::kType_Bow || type == TESObjectWEAP::GameData::kType_CrossBow ||
+			type == TESObjectWEAP::GameData::kType_2HS || type == TESObjectWEAP::GameData::kType_2HA ||
+			type == TESObjectWEAP::GameData::kType_Bow2 || type == TESObjectWEAP::GameData::kType_CBow;
+	}
+	else if (item->IsAmmo())
+	{
+		metadata.kind = kEquipKind_Ammo;
+	}
+	else if (TESObjectARMO * armor = DYNAMIC_CAST(item, TESForm, TESObjectARMO))
+	{
+		metadata.kind = kEquipKind_Armor;
+		metadata.bipedMask = armor->bipedObject.GetSlotMask();
+	}
+	else if (DYNAMIC_CAST(item, TESForm, SpellItem))
+	{
+		metadata.kind = kEquipKind_Spell;
+	}
+	else if (DYNAMIC_CAST(item, TESForm, TESShout))
+	{
+		metadata.kind = kEquipKind_Shout;
+	}
+	else if (item->formType == kFormType_Light)
+	{
+		metadata.kind = kEquipKind_Light; // Torches
+	}
+
 	BGSEquipType * equipType = DYNAMIC_CAST(item, TESForm, BGSEquipType);
-	if (!equipType)
+	if (equipType)
+		metadata.equipSlot = equipType->GetEquipSlot();
+
+	metadata.isSingleHanded = metadata.equipSlot &&
+		(metadata.equipSlot == GetLeftHandSlot() || metadata.equipSlot == GetRightHandSlot());
+
+	return metadata;
+}
+
+EquipMetadata Equipper::CacheEquipMetadata(TESForm * item)
+{
+	std::lock_guard<std::mutex> scopeLock(metadataLock);
+
+	auto itr = metadataCache.find(item->formID);
+	if (itr != metadataCache.end() && itr->second.form == item)
+		return itr->second;
+
+	EquipMetadata metadata = ResolveEquipMetadata(item);
+	metadataCache[item->formID] = metadata;
+	return metadata;
+}
+
+bool Equipper::GetEquipMetadata(UInt32 formId, EquipMetadata &metadata)
+{
+	{
+		std::lock_guard<std::mutex> scopeLock(metadataLock);
+
+		auto itr = metadataCache.find(formId);
+		if (itr != metadataCache.end())
+		{
+			metadata = itr->second;
+			return true;
+		}
+	}
+
+	// Not favorited yet, resolve it now
+	TESForm * item = LookupFormByID(formId);
+	if (!item)
 		return false;
 
-	BGSEquipSlot * equipSlot = equipType->GetEquipSlot();
+	metadata = CacheEquipMetadata(item);
+	return true;
+}
+
+void Equipper::ClearEquipMetadata()
+{
+	std::lock_guard<std::mutex> scopeLock(metadataLock);
+	metadataCache.clear();
+}
+
+void Equipper::ClearInventoryIndex()
+{
+	std::lock_guard<std::mutex> scopeLock(inventoryLock);
+	indexedContainer = NULL;
+	indexedBaseContainer = NULL;
+	inventoryBaseIndex.clear();
+	inventoryIndex.clear();
+}
+
+void Equipper::InvalidateInventoryItem(UInt32 formId)
+{
+	std::lock_guard<std::mutex> scopeLock(inventoryLock);
+	inventoryIndex.erase(formId);
+}
+
+const InventoryBaseEntry& Equipper::GetInventoryBaseEntry(TESForm* item)
+{
+	auto itr = inventoryBaseIndex.find(item->formID);
+	if (itr != inventoryBaseIndex.end())
+		return itr->second;
+
+	InventoryBaseEntry base = { 0, false, 0 };
+
+	if (indexedBaseContainer)
+		base.baseCount = indexedBaseContainer->CountItem(item);
+
+	TESFullName* pFullName = DYNAMIC_CAST(item, TESForm, TESFullName);
+	if (pFullName)
+	{
+		base.hasBaseName = true;
+		base.baseItemId = (SInt32)HashUtil::CRC32(pFullName->name.data, item->formID & 0x00FFFFFF);
+	}
+
+	return inventoryBaseIndex[item->formID] = base;
+}
+
+// Same match as InventoryEntryData::GetEquipItemData: the stacks with the itemId, or the stacks
+// without a custom name when searching for the base item
+static bool IsMatchingStack(BaseExtraList * xList, TESForm * type, SInt32 searchItemId)
+{
+	const char * displayName = xList->GetDisplayName(type);
+	if (searchItemId == 0)
+		return !displayName;
+
+	return displayName && (SInt32)HashUtil::CRC32(displayName, type->formID & 0x00FFFFFF) == searchItemId;
+}
+
+bool Equipper::IsInventoryEntryValid(const InventoryIndexEntry &indexed)
+{
+	// Entries are deleted when their count drops to zero, which drops them from the index,
+	// see InvalidateInventoryItem
+	if (indexed.entry->countDelta != indexed.countDelta)
+		return false;
+
+	// Stacks are split, merged and worn by every equip, also the ones done in the menus.
+	// Each worn stack must be the indexed one and the indexed stacks must still exist.
+	const InventoryEntryData::EquipData &equipData = indexed.equipData;
+	bool hasItemList = equipData.itemExtraList == NULL;
+	bool hasWornList = equipData.wornExtraList == NULL;
+	bool hasWornLeftList = equipData.wornLeftExtraList == NULL;
+
+	if (indexed.entry->extendDataList)
+	{
+		for (ExtendDataList::Iterator it = indexed.entry->extendDataList->Begin(); !it.End(); ++it)
+		{
+			BaseExtraList * xList = it.Get();
+			if (!xList)
+				continue;
+
+			bool isWorn = xList->HasType(kExtraData_Worn);
+			bool isWornLeft = xList->HasType(kExtraData_WornLeft);
+			if ((isWorn && xList != equipData.wornExtraList) || (isWornLeft && xList != equipData.wornLeftExtraList))
+				return false;
+
+			hasWornList |= isWorn;
+			hasWornLeftList |= isWornLeft;
+			hasItemList |= xList == equipData.itemExtraList && !isWorn && !isWornLeft;
+		}
+	}
+	if (!hasItemList || !hasWornList || !hasWornLeftList)
+		return false;
+
+	// Tempering and renaming change the name of a stack without adding or removing the item
+	TESForm * type = indexed.entry->type;
+	if (equipData.itemExtraList && !IsMatchingStack(equipData.itemExtraList, type, indexed.searchItemId))
+		return false;
+	if (equipData.wornExtraList && IsMatchingStack(equipData.wornExtraList, type, indexed.searchItemId) != equipData.isItemWorn)
+		return false;
+	if (equipData.wornLeftExtraList && IsMatchingStack(equipData.wornLeftExtraList, type, indexed.searchItemId) != equipData.isItemWornLeft)
+		return false;
+
+	return true;
+}
+
+void Equipper::GetEquipItemData(ExtraContainerChanges::Data* containerData, const EquipMetadata &item, SInt32 itemId, InventoryEntryData::EquipData &itemData)
+{
+	std::lock_guard<std::mutex> scopeLock(inventoryLock);
+
+	if (containerData != indexedContainer)
+	{
+		inventoryBaseIndex.clear();
+		inventoryIndex.clear();
+		indexedContainer = containerData;
+		indexedBaseContainer = NULL;
+		if (containerData->owner && containerData->owner->baseForm)
+			indexedBaseContainer = DYNAMIC_CAST(containerData->owner->baseForm, TESForm, TESContainer);
+	}
+
+	std::unordered_map<SInt32, InventoryIndexEntry> &itemIndex = inventoryIndex[item.form->formID];
+	auto itr = itemIndex.find(itemId);
+	if (itr != itemIndex.end())
+	{
+		if (IsInventoryEntryValid(itr->second))
+		{
+			itemData = itr->second.equipData;
+			return;
+		}
+		itemIndex.erase(itr);
+	}
+
+	const InventoryBaseEntry &base = GetInventoryBaseEntry(item.form);
+	bool matchedBaseForm = base.hasBaseName && base.baseItemId == itemId;
+
+	// Only the base count is known for items that are not in the inventory, that's cheap and not indexed
+	InventoryEntryData * entry = containerData->FindItemEntry(item.form);
+	if (!entry)
+	{
+		if (matchedBaseForm)
+			itemData.itemCount = base.baseCount;
+		return;
+	}
+
+	SInt32 searchItemId = matchedBaseForm ? 0 : itemId;
+	entry->GetEquipItemData(itemData, searchItemId, base.baseCount);
+
+	InventoryIndexEntry indexed = { entry, entry->countDelta, searchItemId, itemData };
+	itemIndex[itemId] = indexed;
+}
+
+bool Equipper::CanEquipBothHands(Actor* actor, const EquipMetadata &item)
+{
+	BGSEquipSlot * equipSlot = item.equipSlot;
 	if (!equipSlot)
 		return false;
 
@@ -19,7 +248,7 @@ bool Equipper::CanEquipBothHands(Actor* actor, TESForm * item)
 	// 1H
 	else if (equipSlot == GetLeftHandSlot() || equipSlot == GetRightHandSlot())
 	{
-		return (actor->race->data.raceFlags & TESRace::kRace_CanDualWield) && item->IsWeapon();
+		return (actor->race->data.raceFlags & TESRace::kRace_CanDualWield) && item.kind == kEquipKind_Weapon;
 	}
 
 	return false;
@@ -42,13 +271,15 @@ BGSEquipSlot * Equipper::GetEquipSlotById(SInt32 slotId)
 		return NULL;
 }
 
-void EquipItemById(Actor* thisActor, TESForm* item, SInt32 itemId, SInt32 slotId, bool preventUnequip /*unused*/, bool equipSound)
+// Same as papyrusActor::EquipItemById, but uses the cached metadata instead of RTTI casts
+static void EquipItemById(Actor* thisActor, const EquipMetadata &metadata, SInt32 itemId, SInt32 slotId, bool preventUnequip /*unused*/, bool equipSound)
 {
+	TESForm * item = metadata.form;
 	if (!item || !item->Has3D() || itemId == 0)
 		return;
 
 	// Can't be improved or enchanted, no need for itemId
-	if (item->IsAmmo())
+	if (metadata.kind == kEquipKind_Ammo)
 	{
 		papyrusActor::EquipItemEx(thisActor, item, slotId, preventUnequip, equipSound);
 		return;
@@ -64,7 +295,7 @@ void EquipItemById(Actor* thisActor, TESForm* item, SInt32 itemId, SInt32 slotId
 		return;
 
 	InventoryEntryData::EquipData itemData;
-	containerData->GetEquipItemData(itemData, item, itemId);
+	Equipper::GetEquipItemData(containerData, metadata, itemId, itemData);
 
 	BGSEquipSlot * targetEquipSlot = Equipper::GetEquipSlotById(slotId);
 	bool isTargetSlotInUse = false;
@@ -110,7 +341,7 @@ void EquipItemById(Actor* thisActor, TESForm* item, SInt32 itemId, SInt32 slotId
 	bool isItemEquipped = itemData.isItemWorn || itemData.isItemWornLeft;
 
 	// Does this item qualify for dual wield?
-	if (item->IsWeapon() && targetEquipSlot && isItemEquipped && Equipper::CanEquipBothHands(thisActor, item))
+	if (metadata.kind == kEquipKind_Weapon && targetEquipSlot && isItemEquipped && Equipper::CanEquipBothHands(thisActor, metadata))
 		canDualWield = true;
 
 	// Not enough items to dual wield, weapon has to swap hands
@@ -125,16 +356,16 @@ void EquipItemById(Actor* thisActor, TESForm* item, SInt32 itemId, SInt32 slotId
 	CALL_MEMBER_FN(equipManager, EquipItem)(thisActor, item, newEquipList, 1, targetEquipSlot, equipSound, preventUnequip, false, NULL);
 }
 
-void Equipper::EquipItem(PlayerCharacter *player, TESForm *item, SInt32 itemId, UInt32 slotId) {
+void Equipper::EquipItem(PlayerCharacter *player, const EquipMetadata &metadata, SInt32 itemId, UInt32 slotId) {
 
-	TESObjectARMO *armor = DYNAMIC_CAST(item, TESForm, TESObjectARMO);
+	TESForm *item = metadata.form;
 
 	// If it's armor, unequip item in target slot first
-	if (armor) {
+	if (metadata.kind == kEquipKind_Armor) {
 		EquipManager* equipManager = EquipManager::GetSingleton();
 		if (!equipManager)
 			return;
-		UInt32 slotMask = armor->bipedObject.GetSlotMask();
+		UInt32 slotMask = metadata.bipedMask;
 		TESForm *wornItem = papyrusActor::GetWornForm(player, slotMask);
 		if (wornItem) {
 			papyrusActor::UnequipItemEx(player, wornItem, 0, false);
@@ -145,13 +376,13 @@ void Equipper::EquipItem(PlayerCharacter *player, TESForm *item, SInt32 itemId,
 		if (!containerData)
 			return;
 
-		BGSEquipSlot *equipSlot = armor->equipType.equipSlot;
+		BGSEquipSlot *equipSlot = metadata.equipSlot;
 		InventoryEntryData::EquipData itemData;
-		containerData->GetEquipItemData(itemData, item, itemId);
+		GetEquipItemData(containerData, metadata, itemId, itemData);
 		CALL_MEMBER_FN(equipManager, EquipItem)(player, item, itemData.itemExtraList, 1, equipSlot, true, false, false, NULL);
 	}
 	else {
-		papyrusActor::EquipItemById(player, item, itemId, slotId, false, true);
+		EquipItemById(player, metadata, itemId, slotId, false, true);
 	}
 
 }
@@ -8,6 +8,46 @@
 #include "skse64/PapyrusActor.h"
 #include "skse64/GameInput.h"
 #include "skse64/HashUtil.h"
+#include <unordered_map>
+#include <mutex>
+
+enum EquipKind
+{
+	kEquipKind_Other = 0,
+	kEquipKind_Weapon,
+	kEquipKind_Armor,
+	kEquipKind_Ammo,
+	kEquipKind_Spell,
+	kEquipKind_Shout,
+	kEquipKind_Light
+};
+
+// Resolved equip information of a form, cached so equipping doesn't need RTTI casts
+struct EquipMetadata {
+	TESForm * form;
+	UInt8 kind;
+	BGSEquipSlot * equipSlot;	// NULL if the form has no equip type
+	bool isSingleHanded;		// True if equipped in the left or right hand
+	UInt32 bipedMask;			// Armor only
+	bool isTwoHanded;			// Weapons that take both hands: greatswords, battleaxes, warhammers, bows, crossbows
+};
+
+// Base container data of an item, it doesn't change while a game is running
+struct InventoryBaseEntry {
+	UInt32 baseCount;			// Count in the base container of the owner
+	bool hasBaseName;
+	SInt32 baseItemId;			// itemId of the stacks without a custom name
+};
+
+// Equip data of the stacks of an item with an itemId, indexed so equipping doesn't resolve
+// the display names of all the stacks again. The entries of an item are dropped when it is
+// added to or removed from the inventory, so the indexed entry is still owned by the inventory.
+struct InventoryIndexEntry {
+	InventoryEntryData * entry;
+	SInt32 countDelta;			// Of the entry when indexed
+	SInt32 searchItemId;		// itemId passed to InventoryEntryData::GetEquipItemData, 0 for the stacks without a custom name
+	InventoryEntryData::EquipData equipData;
+};
 
 class Equipper
 {
@@ -15,8 +55,37 @@ public:
 	Equipper();
 	~Equipper();
 
-	static bool CanEquipBothHands(Actor*, TESForm* item);
+	// Resolve the metadata of a form and cache it. Called when favorites are refreshed.
+	static EquipMetadata CacheEquipMetadata(TESForm* item);
+	// Get the cached metadata, the form is looked up and cached if missing.
+	// Returns false if the form doesn't exist.
+	static bool GetEquipMetadata(UInt32 formId, EquipMetadata &metadata);
+	// Form ids may point to other forms after loading a game
+	static void ClearEquipMetadata();
+
+	static void ClearInventoryIndex();
+	// Drop the indexed stacks of an item, called when the item is added to or removed from the inventory
+	static void InvalidateInventoryItem(UInt32 formId);
+	// Same as ExtraContainerChanges::Data::GetEquipItemData, but the result is indexed by formId and itemId.
+	// An indexed result is used after checking the stacks of its entry: the worn ones must be the indexed
+	// ones and the indexed ones must still have a matching name, which tempering or renaming changes in place.
+	static void GetEquipItemData(ExtraContainerChanges::Data* containerData, const EquipMetadata &item, SInt32 itemId, InventoryEntryData::EquipData &itemData);
+
+	static bool CanEquipBothHands(Actor*, const EquipMetadata &item);
 	static BGSEquipSlot* GetEquipSlotById(SInt32 slotId);
-	static void EquipItem(PlayerCharacter* player, TESForm *item, SInt32 itemId, UInt32 slotId);
+	static void EquipItem(PlayerCharacter* player, const EquipMetadata &item, SInt32 itemId, UInt32 slotId);
+
+private:
+	static std::mutex metadataLock;
+	static std::unordered_map<UInt32 /* formId */, EquipMetadata> metadataCache;
+
+	static const InventoryBaseEntry& GetInventoryBaseEntry(TESForm* item);
+	static bool IsInventoryEntryValid(const InventoryIndexEntry &indexed);
+
+	static std::mutex inventoryLock;
+	static ExtraContainerChanges::Data * indexedContainer;
+	static TESContainer * indexedBaseContainer;
+	static std::unordered_map<UInt32 /* formId */, InventoryBaseEntry> inventoryBaseIndex;
+	static std::unordered_map<UInt32 /* formId */, std::unordered_map<SInt32 /* itemId */, InventoryIndexEntry>> inventoryIndex;
 };
 
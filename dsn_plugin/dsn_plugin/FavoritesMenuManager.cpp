@@ -3,6 +3,7 @@
 #include "SkyrimType.h"
 #include "Equipper.h"
 #include "SpeechRecognitionClient.h"
+#include "ConsoleCommandRunner.h"
 #include "skse64/GameAPI.h"
 #include "skse64/GameRTTI.h"
 #include "skse64/GameData.h"
@@ -10,7 +11,16 @@
 #include "skse64/GameTypes.h"
 #include "skse64/PapyrusActor.h"
 #include "skse64/GameInput.h"
+#include "skse64/GameMenus.h"
 #include "skse64/HashUtil.h"
+#include "TimeUtils.hpp"
+#include "PathUtils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+static const char* FAVORITES_SNAPSHOT_FILE = "favorites_snapshot.txt";
 
 FavoritesMenuManager* FavoritesMenuManager::instance = NULL;
 
@@ -22,166 +32,432 @@ FavoritesMenuManager* FavoritesMenuManager::getInstance() {
 
 FavoritesMenuManager::FavoritesMenuManager(){}
 
-SInt32 fmCalcItemId(TESForm * form, BaseExtraList * extraList)
-{
-	if (!form || !extraList)
-		return 0;
-
-	const char * name = extraList->GetDisplayName(form);
+UInt32 FavoriteNamePool::Intern(const char* name) {
+	size_t length = strlen(name);
+	UInt32 hash = HashUtil::CRC32(name, length, 0);
 
-	// No name in extra data? Use base form name
-	if (!name)
-	{
-		TESFullName* pFullName = DYNAMIC_CAST(form, TESForm, TESFullName);
-		if (pFullName)
-			name = pFullName->name.data;
+	auto range = index.equal_range(hash);
+	for (auto itr = range.first; itr != range.second; itr++) {
+		const std::string &interned = names[itr->second];
+		if (interned.length() == length && memcmp(interned.data(), name, length) == 0) {
+			return itr->second;
+		}
 	}
 
-	if (!name)
-		return 0;
+	UInt32 nameId = (UInt32)names.size();
+	names.push_back(std::string(name, length));
+	index.insert(std::make_pair(hash, nameId));
+	return nameId;
+}
+
+void FavoriteNamePool::Swap(FavoriteNamePool &other) {
+	names.swap(other.names);
+	index.swap(other.index);
+}
 
-	return (SInt32)HashUtil::CRC32(name, form->formID & 0x00FFFFFF);
+void FavoriteNamePool::Clear() {
+	names.clear();
+	index.clear();
 }
 
-bool IsEquipmentSingleHanded(TESForm *item) {
-	BGSEquipType * equipType = DYNAMIC_CAST(item, TESForm, BGSEquipType);
-	if (!equipType)
-		return false;
+void FavoritesTable::clear() {
+	formIds.clear();
+	itemIds.clear();
+	nameIds.clear();
+	itemTypes.clear();
+	isHanded.clear();
+}
 
-	BGSEquipSlot * equipSlot = equipType->GetEquipSlot();
-	if (!equipSlot)
-		return false;
+void FavoritesTable::push_back(const FavoriteMenuItem &item) {
+	formIds.push_back(item.TESFormId);
+	itemIds.push_back(item.itemId);
+	nameIds.push_back(item.nameId);
+	itemTypes.push_back(item.itemType);
+	isHanded.push_back(item.isHanded);
+}
 
-	return (equipSlot == GetLeftHandSlot() || equipSlot == GetRightHandSlot());
+// Order-sensitive 64-bit FNV-1a step, used to detect an unchanged favorites list without building the command
+static inline UInt64 MixFingerprint(UInt64 fingerprint, UInt64 value) {
+	const UInt64 FNV_PRIME = 0x100000001B3ULL;
+	for (int i = 0; i < 8; i++) {
+		fingerprint = (fingerprint ^ (value & 0xFF)) * FNV_PRIME;
+		value >>= 8;
+	}
+	return fingerprint;
+}
+
+static const UInt64 FNV_OFFSET_BASIS = 0xCBF29CE484222325ULL;
+
+// Chains one favorite into the fingerprint, the favorites are chained in the order they are sent
+static inline UInt64 MixFingerprintItem(UInt64 fingerprint, const FavoriteMenuItem &item) {
+	fingerprint = MixFingerprint(fingerprint, ((UInt64)item.TESFormId << 32) | (UInt32)item.itemId);
+	fingerprint = MixFingerprint(fingerprint, ((UInt64)item.nameId << 16) | (item.itemType << 8) | item.isHanded);
+	return fingerprint;
+}
+
+static UInt64 MixFingerprintItems(UInt64 fingerprint, const std::vector<FavoriteMenuItem> &items) {
+	for (size_t i = 0; i < items.size(); i++) {
+		fingerprint = MixFingerprintItem(fingerprint, items[i]);
+	}
+	return fingerprint;
+}
+
+// Append a number without the temporary string of std::to_string
+static void AppendNumber(std::string &buffer, SInt64 value) {
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *begin = end;
+	UInt64 magnitude = value < 0 ? 0 - (UInt64)value : (UInt64)value;
+	do {
+		*--begin = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0) {
+		*--begin = '-';
+	}
+	buffer.append(begin, end);
 }
 
-std::vector<FavoriteMenuItem> ExtractFavorites(InventoryEntryData * inv) {
-	std::vector<FavoriteMenuItem> menuItems;
+// Returns the number of hotkeyed stacks, including the ones skipped for lack of a name
+static UInt32 ExtractFavorites(InventoryEntryData * inv, FavoriteNamePool &names, std::vector<FavoriteMenuItem> &menuItems) {
+	menuItems.clear();
+	UInt32 hotkeyCount = 0;
 	ExtendDataList* pExtendList = inv->extendDataList;
 
 	if (pExtendList)
 	{
-		bool isHanded = IsEquipmentSingleHanded(inv->type);
+		// Cache the equip metadata now, so equipping the item later doesn't need to resolve it
+		bool isHanded = Equipper::CacheEquipMetadata(inv->type).isSingleHanded;
 		TESFullName *baseFullname = DYNAMIC_CAST(inv->type, TESForm, TESFullName);
-		std::string baseName = std::string(baseFullname->name.data);
-		SInt32 n = 0;
-		BaseExtraList* itemExtraDataList = pExtendList->GetNthItem(n);
-		while (itemExtraDataList)
+		const char* baseName = baseFullname ? baseFullname->name.data : NULL;
+
+		// Single pass over the stacks, GetNthItem(n) would walk the list from the head for each stack
+		for (ExtendDataList::Iterator it = pExtendList->Begin(); !it.End(); ++it)
 		{
+			BaseExtraList* itemExtraDataList = it.Get();
+			if (!itemExtraDataList) {
+				continue;
+			}
+
 			// Check if item is hotkeyed
-			if (ExtraHotkey * extraHotkey = static_cast<ExtraHotkey*>(itemExtraDataList->GetByType(kExtraData_Hotkey)))
+			if (!itemExtraDataList->HasType(kExtraData_Hotkey)) {
+				continue;
+			}
+			hotkeyCount++;
+
+			// Resolve the display name once, it's used by both the name and the SKSE itemId.
+			// No name in extra data? Use base form name.
+			const char* displayName = itemExtraDataList->GetDisplayName(inv->type);
+			if (!displayName) {
+				displayName = baseName;
+			}
+			if (!displayName) {
+				continue;
+			}
+
+			SInt32 itemId = (SInt32)HashUtil::CRC32(displayName, inv->type->formID & 0x00FFFFFF);
+			const char* name = displayName;
+
+			if (ExtraTextDisplayData * textDisplayData = static_cast<ExtraTextDisplayData*>(itemExtraDataList->GetByType(kExtraData_TextDisplayData)))
 			{
-				std::string name = baseName;
-				const char* modifiedName = itemExtraDataList->GetDisplayName(inv->type);
-				if (modifiedName) {
-					name = std::string(modifiedName);
-				}
-				SInt32 itemId = fmCalcItemId(inv->type, itemExtraDataList);
-
-				if (ExtraTextDisplayData * textDisplayData = static_cast<ExtraTextDisplayData*>(itemExtraDataList->GetByType(kExtraData_TextDisplayData)))
-				{
-					if (textDisplayData->name.data) {
-						name = std::string(textDisplayData->name.data);
-						const char* displayName = itemExtraDataList->GetDisplayName(inv->type);
-						itemId = (SInt32)HashUtil::CRC32(displayName, inv->type->formID & 0x00FFFFFF);
-					}
+				if (textDisplayData->name.data) {
+					name = textDisplayData->name.data;
 				}
+			}
+
+			FavoriteMenuItem entry = {
+				inv->type->formID,
+				itemId,
+				names.Intern(name),
+				1, // Equipment
+				isHanded };
+
+			menuItems.push_back(entry);
+		}
+	}
+	return hotkeyCount;
+}
+
+// Number of hotkeyed stacks of an inventory item, each of them is a favorite
+static UInt32 CountHotkeys(InventoryEntryData * inv) {
+	UInt32 count = 0;
+	if (inv->extendDataList) {
+		for (ExtendDataList::Iterator it = inv->extendDataList->Begin(); !it.End(); ++it) {
+			BaseExtraList * xList = it.Get();
+			if (xList && xList->HasType(kExtraData_Hotkey)) {
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+bool FavoritesMenuManager::UpdateEquipment(UInt32 formId, InventoryEntryData * inv) {
+	std::vector<FavoriteMenuItem> &items = extractedItems;
+	items.clear();
+	UInt32 hotkeyCount = 0;
+	if (inv && inv->type) {
+		hotkeyCount = ExtractFavorites(inv, names, items);
+	}
+
+	// An item is kept while it has hotkeys, even if none of its stacks could be named,
+	// otherwise its hotkey count would never match the index and it would be extracted on every refresh
+	auto itr = equipmentFavorites.find(formId);
+	if (hotkeyCount == 0) {
+		if (itr == equipmentFavorites.end()) {
+			return false;
+		}
+		equipmentFavorites.erase(itr);
+		return true;
+	}
+
+	if (itr != equipmentFavorites.end() && itr->second.items == items) {
+		itr->second.generation = generation;
+		itr->second.hotkeyCount = hotkeyCount;
+		return false;
+	}
+
+	// Swapped rather than copied, the extraction reuses the replaced vector
+	FavoriteEquipment &equipment = equipmentFavorites[formId];
+	equipment.generation = generation;
+	equipment.hotkeyCount = hotkeyCount;
+	equipment.items.swap(items);
+	return true;
+}
+
+bool FavoritesMenuManager::UpdateSpells() {
+	FakeMagicFavorites * magicFavorites = (FakeMagicFavorites*)MagicFavorites::GetSingleton();
+	if (!magicFavorites) {
+		return false;
+	}
+
+	// Only resolve the spells again if the favorited forms changed
+	UnkFormArray &spellArray = magicFavorites->spells;
+	if (spellArray.count == spellForms.size()) {
+		bool isSame = true;
+		for (UInt32 i = 0; i < spellArray.count && isSame; i++) {
+			isSame = spellArray.entries[i] == spellForms[i];
+		}
+		if (isSame) {
+			return false;
+		}
+	}
+
+	spellForms.assign(spellArray.entries, spellArray.entries + spellArray.count);
+	spellFavorites.clear();
+
+	for (int i = 0; i < spellArray.count; i++) {
+		TESForm* spellForm = spellArray.entries[i];
+		if (spellForm) {
+			Equipper::CacheEquipMetadata(spellForm);
+
+			SpellItem *spellItem = DYNAMIC_CAST(spellForm, TESForm, SpellItem);
+			if (spellItem) {
+				FavoriteMenuItem entry = {
+					spellForm->formID,
+					0,
+					names.Intern(spellItem->fullName.name.data),
+					2, // Spell
+					true };
+				spellFavorites.push_back(entry);
+			}
+
+			TESShout *shout = DYNAMIC_CAST(spellForm, TESForm, TESShout);
+			if (shout) {
 
 				FavoriteMenuItem entry = {
-					inv->type->formID,
-					itemId,
-					name,
-					1, // Equipment
-					isHanded };
+				shout->formID,
+				0,
+				names.Intern(shout->fullName.name.data),
+				3, // Shout
+				false };
 
-				menuItems.push_back(entry);
+				spellFavorites.push_back(entry);
 			}
-			n++;
-			itemExtraDataList = pExtendList->GetNthItem(n);
 		}
 	}
 
-	return menuItems;
+	return true;
 }
 
-void FavoritesMenuManager::RefreshFavorites() {
+// Same order as SendFavorites: the equipment by formId, then the spells and shouts
+UInt64 FavoritesMenuManager::FingerprintFavorites() {
+	UInt64 fingerprint = FNV_OFFSET_BASIS;
+	for (auto itr = equipmentFavorites.begin(); itr != equipmentFavorites.end(); itr++) {
+		fingerprint = MixFingerprintItems(fingerprint, itr->second.items);
+	}
+	return MixFingerprintItems(fingerprint, spellFavorites);
+}
+
+// Names of removed favorites stay in the pool, so it is rebuilt from the current favorites once most of it is unused.
+// Returns true if the name ids changed.
+bool FavoritesMenuManager::CompactNames() {
+	size_t usedCount = spellFavorites.size();
+	for (auto itr = equipmentFavorites.begin(); itr != equipmentFavorites.end(); itr++) {
+		usedCount += itr->second.items.size();
+	}
+	if (names.size() <= 2 * usedCount + 64) {
+		return false;
+	}
+
+	size_t unusedCount = names.size() - usedCount;
+	FavoriteNamePool compacted;
+	for (auto itr = equipmentFavorites.begin(); itr != equipmentFavorites.end(); itr++) {
+		std::vector<FavoriteMenuItem> &items = itr->second.items;
+		for (size_t i = 0; i < items.size(); i++) {
+			items[i].nameId = compacted.Intern(names.Get(items[i].nameId).c_str());
+		}
+	}
+	for (size_t i = 0; i < spellFavorites.size(); i++) {
+		spellFavorites[i].nameId = compacted.Intern(names.Get(spellFavorites[i].nameId).c_str());
+	}
+	names.Swap(compacted);
+
+	Log::infof("Favorite names compacted: %zu unused dropped", unusedCount);
+	return true;
+}
+
+// The caller already compared the fingerprint of the favorites with the last sent one
+void FavoritesMenuManager::SendFavorites(UInt64 beginTime, UInt64 fingerprint) {
+	// The fingerprint hashes name ids
+	if (CompactNames()) {
+		fingerprint = FingerprintFavorites();
+	}
+	lastFavoritesFingerprint = fingerprint;
+
+	favorites.clear();
+	for (auto itr = equipmentFavorites.begin(); itr != equipmentFavorites.end(); itr++) {
+		for (size_t i = 0; i < itr->second.items.size(); i++) {
+			favorites.push_back(itr->second.items[i]);
+		}
+	}
+	for (size_t i = 0; i < spellFavorites.size(); i++) {
+		favorites.push_back(spellFavorites[i]);
+	}
+
+	// The buffer keeps its capacity, building the command doesn't allocate once it's large enough
+	std::string &command = commandBuffer;
+	command.assign("FAVORITES");
+	for (size_t i = 0; i < favorites.size(); i++) {
+		command.push_back('|');
+		command.append(names.Get(favorites.nameIds[i]));
+		command.push_back(',');
+		AppendNumber(command, favorites.formIds[i]);
+		command.push_back(',');
+		AppendNumber(command, favorites.itemIds[i]);
+		command.push_back(',');
+		AppendNumber(command, favorites.isHanded[i]);
+		command.push_back(',');
+		AppendNumber(command, favorites.itemTypes[i]);
+	}
+
+	if (lastFavoritesCommand != command) {
+		SpeechRecognitionClient::getInstance()->WriteLine(command);
+		lastFavoritesCommand.assign(command);
+		if (!favorites.empty()) {
+			SaveSnapshot(command);
+		}
+		Log::infof("Favorites refreshed: %zu items, %lluus", favorites.size(), GetTimeMicroseconds() - beginTime);
+	}
+}
+
+void FavoritesMenuManager::UpdateFavorites(bool forceSend) {
+	UInt64 beginTime = GetTimeMicroseconds();
 
 	PlayerCharacter *player = (*g_thePlayer);
-	if (player != NULL) {
+	if (player == NULL) {
+		return;
+	}
 
-		// Clear current favorites
-		favorites.clear();
+	TakeChangedItems();
+	bool isChanged = forceSend;
+	generation++;
 
-		// Equipment
-		ExtraContainerChanges* pContainerChanges = static_cast<ExtraContainerChanges*>(player->extraData.GetByType(kExtraData_ContainerChanges));
-		if (pContainerChanges && pContainerChanges->data) {
-			for (EntryDataList::Iterator it = pContainerChanges->data->objList->Begin(); !it.End(); ++it)
-			{
-				InventoryEntryData *inv = it.Get();
-				TESForm* type = inv->type;
-				if (type) {
-					HotkeyData data = pContainerChanges->FindHotkey(type);
-					if (data.pHotkey)
-					{
-						std::vector<FavoriteMenuItem> itemEntries = ExtractFavorites(inv);
-						for (int i = 0; i < itemEntries.size(); i++) {
-							favorites.push_back(itemEntries[i]);
-						}
-					}
-				}
+	// Equipment
+	ExtraContainerChanges* pContainerChanges = static_cast<ExtraContainerChanges*>(player->extraData.GetByType(kExtraData_ContainerChanges));
+	if (pContainerChanges && pContainerChanges->data && pContainerChanges->data->objList) {
+		for (EntryDataList::Iterator it = pContainerChanges->data->objList->Begin(); !it.End(); ++it)
+		{
+			InventoryEntryData *inv = it.Get();
+			if (!inv || !inv->type) {
+				continue;
 			}
-		}
 
-		// Spells/Shouts
-		FakeMagicFavorites * magicFavorites = (FakeMagicFavorites*)MagicFavorites::GetSingleton();
-		if (magicFavorites) {
-			UnkFormArray spellArray = magicFavorites->spells;
-			for (int i = 0; i < spellArray.count; i++) {
-				TESForm* spellForm = spellArray.entries[i];
-				if (spellForm) {
-					SpellItem *spellItem = DYNAMIC_CAST(spellForm, TESForm, SpellItem);
-					if (spellItem) {
-						FavoriteMenuItem entry = {
-							spellForm->formID,
-							0,
-							std::string(spellItem->fullName.name.data),
-							2, // Spell
-							true };
-						favorites.push_back(entry);
-					}
-
-					TESShout *shout = DYNAMIC_CAST(spellForm, TESForm, TESShout);
-					if (shout) {
-
-						FavoriteMenuItem entry = {
-						shout->formID,
-						0,
-						std::string(shout->fullName.name.data),
-						3, // Shout
-						false };
-
-						favorites.push_back(entry);
-					}
-				}
+			// Hotkeys can be set or cleared without any event,
+			// so compare the hotkey count with the index to find the changed items.
+			UInt32 formId = inv->type->formID;
+			UInt32 hotkeyCount = CountHotkeys(inv);
+			auto itr = equipmentFavorites.find(formId);
+			UInt32 indexedCount = itr != equipmentFavorites.end() ? itr->second.hotkeyCount : 0;
+
+			if (hotkeyCount != indexedCount || (hotkeyCount > 0 && std::binary_search(takenItems.begin(), takenItems.end(), formId))) {
+				isChanged |= UpdateEquipment(formId, inv);
+				itr = equipmentFavorites.find(formId);
+			}
+			else if (itr != equipmentFavorites.end()) {
+				itr->second.generation = generation;
 			}
 		}
+	}
 
-		std::string command = "FAVORITES";
-		for (int i = 0; i < favorites.size(); i++) {
-			FavoriteMenuItem favorite = favorites[i];
-			command += "|" + favorite.fullname + "," + std::to_string(favorite.TESFormId) + "," + std::to_string(favorite.itemId) + "," + std::to_string(favorite.isHanded) + "," + std::to_string(favorite.itemType);
+	// Remove items that are no longer in the inventory
+	for (auto itr = equipmentFavorites.begin(); itr != equipmentFavorites.end();) {
+		if (itr->second.generation != generation) {
+			itr = equipmentFavorites.erase(itr);
+			isChanged = true;
+		}
+		else {
+			itr++;
 		}
+	}
+
+	// Spells/Shouts
+	isChanged |= UpdateSpells();
 
-		if (lastFavoritesCommand != command) {
-			SpeechRecognitionClient::getInstance()->WriteLine(command);
-			lastFavoritesCommand = command;
+	// Nothing is built when the favorites are the same as the last sent ones
+	if (isChanged) {
+		UInt64 fingerprint = FingerprintFavorites();
+		if (forceSend || fingerprint != lastFavoritesFingerprint) {
+			SendFavorites(beginTime, fingerprint);
 		}
 	}
 }
 
+void FavoritesMenuManager::ReloadFavorites() {
+	std::lock_guard<std::mutex> scopeLock(favoritesLock);
+
+	equipmentFavorites.clear();
+	spellForms.clear();
+	spellFavorites.clear();
+	names.Clear();
+	lastFavoritesFingerprint = 0;
+	TakeChangedItems();
+	Equipper::ClearEquipMetadata();
+	Equipper::ClearInventoryIndex();
+
+	UpdateFavorites(true);
+}
+
+void FavoritesMenuManager::RefreshFavorites() {
+	// The item menus ask for a refresh on every change, so the inventory is walked once they are closed
+	std::lock_guard<std::mutex> scopeLock(changedItemsLock);
+	isRefreshPending = true;
+}
+
 void FavoritesMenuManager::ClearFavorites() {
+	std::lock_guard<std::mutex> scopeLock(favoritesLock);
+
 	// Clear current favorites
+	equipmentFavorites.clear();
+	spellForms.clear();
+	spellFavorites.clear();
+	names.Clear();
+	lastFavoritesFingerprint = 0;
 	favorites.clear();
+	TakeChangedItems();
+	Equipper::ClearEquipMetadata();
+	Equipper::ClearInventoryIndex();
+
 	std::string command = "FAVORITES";
 	if (lastFavoritesCommand != command) {
 		SpeechRecognitionClient::getInstance()->WriteLine(command);
@@ -189,30 +465,142 @@ void FavoritesMenuManager::ClearFavorites() {
 	}
 }
 
-static std::vector<std::string> split(const std::string &s, char delim) {
-	std::stringstream ss(s);
-	std::string item;
-	std::vector<std::string> tokens;
-	while (std::getline(ss, item, delim)) {
-		tokens.push_back(item);
+static DWORD WINAPI SnapshotWriterThreadStart(void* ctx) {
+	((FavoritesMenuManager*)ctx)->WriteSnapshots();
+	return 0;
+}
+
+// Called in the game thread, the file is written by the snapshot writer thread
+void FavoritesMenuManager::SaveSnapshot(const std::string &command) {
+	std::lock_guard<std::mutex> scopeLock(snapshotLock);
+	pendingSnapshot.assign(command);
+	if (snapshotEvent == NULL) {
+		snapshotEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		CreateThread(NULL, 0, SnapshotWriterThreadStart, this, 0L, NULL);
+	}
+	SetEvent(snapshotEvent);
+}
+
+// The snapshot is the CRC32 of the FAVORITES command in hex followed by the command, one per line.
+// Only the latest command is written when several are saved while writing.
+void FavoritesMenuManager::WriteSnapshots() {
+	std::string command;
+	for (;;) {
+		WaitForSingleObject(snapshotEvent, INFINITE);
+
+		std::lock_guard<std::mutex> fileLock(snapshotFileLock);
+		{
+			std::lock_guard<std::mutex> scopeLock(snapshotLock);
+			command.swap(pendingSnapshot);
+			pendingSnapshot.clear();
+		}
+		if (command.empty()) {
+			continue;
+		}
+
+		std::ofstream snapshotFile(GetUserDataDirectory() + FAVORITES_SNAPSHOT_FILE, std::ios_base::out | std::ios_base::trunc);
+		if (!snapshotFile) {
+			continue;
+		}
+		snapshotFile << std::hex << HashUtil::CRC32(command.c_str(), command.length(), 0) << std::endl;
+		snapshotFile << command << std::endl;
+	}
+}
+
+void FavoritesMenuManager::SendSnapshot() {
+	std::string crcLine, command;
+	{
+		std::lock_guard<std::mutex> fileLock(snapshotFileLock);
+		std::ifstream snapshotFile(GetUserDataDirectory() + FAVORITES_SNAPSHOT_FILE);
+		if (!snapshotFile) {
+			return;
+		}
+		if (!std::getline(snapshotFile, crcLine) || !std::getline(snapshotFile, command)) {
+			return;
+		}
+	}
+
+	// Ignore a truncated or edited snapshot
+	std::stringstream crcStream;
+	crcStream << std::hex << HashUtil::CRC32(command.c_str(), command.length(), 0);
+	if (crcStream.str() != crcLine || command.compare(0, 10, "FAVORITES|") != 0) {
+		Log::info("Favorites snapshot is invalid, ignored");
+		return;
+	}
+
+	SpeechRecognitionClient::getInstance()->WriteLine("FAVORITES_SNAPSHOT" + command.substr(9));
+	Log::info("Favorites snapshot sent");
+}
+
+void FavoritesMenuManager::MarkItemChanged(UInt32 formId) {
+	std::lock_guard<std::mutex> scopeLock(changedItemsLock);
+	changedItems.push_back(formId);
+}
+
+// Move the changed items to takenItems, sorted and without duplicates.
+// Both vectors keep their capacity across the swaps.
+void FavoritesMenuManager::TakeChangedItems() {
+	takenItems.clear();
+	{
+		std::lock_guard<std::mutex> scopeLock(changedItemsLock);
+		takenItems.swap(changedItems);
 	}
-	return tokens;
+	std::sort(takenItems.begin(), takenItems.end());
+	takenItems.erase(std::unique(takenItems.begin(), takenItems.end()), takenItems.end());
+}
+
+// Hotkeys are only set or cleared in the item menus (inventory, magic, favorites...)
+static bool IsItemMenuOpen() {
+	MenuManager *menuManager = MenuManager::GetSingleton();
+	return menuManager && menuManager->numItemMenu > 0;
 }
 
-EquipItem parseEquipItem(std::string command) {
-	std::vector<std::string> tokens = split(command, ';');
+void FavoritesMenuManager::ProcessChangedItems() {
+	bool isRefreshDue;
+	{
+		std::lock_guard<std::mutex> scopeLock(changedItemsLock);
+		isRefreshDue = isRefreshPending && !IsItemMenuOpen();
+		if (changedItems.empty() && !isRefreshDue) {
+			return;
+		}
+		if (isRefreshDue) {
+			isRefreshPending = false;
+		}
+	}
+
+	std::lock_guard<std::mutex> scopeLock(favoritesLock);
+	if (isRefreshDue) {
+		// The full refresh also updates the changed items
+		UpdateFavorites(false);
+		return;
+	}
 
-	char* formId = (char*)tokens[0].c_str();
-	char* end = formId + strlen(formId);
+	UInt64 beginTime = GetTimeMicroseconds();
 
-	EquipItem item = {
-		(UInt32)std::strtoul(formId, &end, 10),
-		(SInt32)std::atoi(tokens[1].c_str()),
-		(UInt8)std::atoi(tokens[2].c_str()),
-		(SInt32)std::atoi(tokens[3].c_str())
-	};
+	PlayerCharacter *player = (*g_thePlayer);
+	if (player == NULL) {
+		return;
+	}
+
+	ExtraContainerChanges* pContainerChanges = static_cast<ExtraContainerChanges*>(player->extraData.GetByType(kExtraData_ContainerChanges));
+	if (!pContainerChanges || !pContainerChanges->data) {
+		return;
+	}
+
+	bool isChanged = false;
+	TakeChangedItems();
+	for (auto itr = takenItems.begin(); itr != takenItems.end(); itr++) {
+		TESForm * form = LookupFormByID(*itr);
+		InventoryEntryData * inv = form ? pContainerChanges->data->FindItemEntry(form) : NULL;
+		isChanged |= UpdateEquipment(*itr, inv);
+	}
 
-	return item;
+	if (isChanged) {
+		UInt64 fingerprint = FingerprintFavorites();
+		if (fingerprint != lastFavoritesFingerprint) {
+			SendFavorites(beginTime, fingerprint);
+		}
+	}
 }
 
 enum
@@ -222,47 +610,145 @@ enum
 	kSlotId_Left = 2
 };
 
+// Slots used to find conflicting equips in a batch
+enum
+{
+	kEquipSlot_Right = 1 << 0,
+	kEquipSlot_Left = 1 << 1,
+	kEquipSlot_Voice = 1 << 2,
+	kEquipSlot_Ammo = 1 << 3,
+	kEquipSlot_Hands = kEquipSlot_Right | kEquipSlot_Left,
+	kEquipSlot_BipedShift = 32 // Armor biped slot mask is stored in the high 32 bits
+};
+
+static UInt64 GetEquipSlots(const EquipItem &equipItem, const EquipMetadata &metadata) {
+	UInt64 handSlots = equipItem.hand == kSlotId_Right ? kEquipSlot_Right :
+		equipItem.hand == kSlotId_Left ? kEquipSlot_Left : kEquipSlot_Hands;
+
+	switch (equipItem.itemType) {
+	case 1: // Item
+		switch (metadata.kind) {
+		case kEquipKind_Armor:
+			// A shield is held in the left hand
+			if (metadata.bipedMask & BGSBipedObjectForm::kPart_Shield) {
+				return kEquipSlot_Left | ((UInt64)metadata.bipedMask << kEquipSlot_BipedShift);
+			}
+			return (UInt64)metadata.bipedMask << kEquipSlot_BipedShift;
+		case kEquipKind_Weapon:
+			// Whatever hand was said
+			return metadata.isTwoHanded ? kEquipSlot_Hands : handSlots;
+		case kEquipKind_Light:
+			return kEquipSlot_Left;
+		case kEquipKind_Ammo:
+			return kEquipSlot_Ammo;
+		}
+		return 0; // Potions and others never conflict
+	case 2: // Spell
+		return handSlots;
+	case 3: // Shout
+		return kEquipSlot_Voice;
+	}
+	return 0;
+}
+
+// Whether an equip asked for both hands and can still be equipped in one of them when a later equip takes the other
+static bool CanMoveToOneHand(const PendingEquip &pending) {
+	if (pending.item.hand != kSlotId_Both) {
+		return false;
+	}
+	return pending.item.itemType == 2 || // Spell
+		(pending.item.itemType == 1 && pending.metadata.kind == kEquipKind_Weapon && !pending.metadata.isTwoHanded);
+}
+
+// SKSE has no native equip for spells and shouts, so the console command is used.
+// It's run right away in the game thread instead of being queued, so both hands are equipped in the same frame.
+static void RunEquipCommand(const char* command, UInt32 formId, const char* hand) {
+	char buffer[64];
+	sprintf_s(buffer, "%s %x%s", command, formId, hand);
+	ConsoleCommandRunner::RunCommand(buffer);
+}
 
 void FavoritesMenuManager::ProcessEquipCommands() {
 
 	PlayerCharacter *player = (*g_thePlayer);
 	SpeechRecognitionClient *client = SpeechRecognitionClient::getInstance();
 	EquipManager *equipManager = EquipManager::GetSingleton();
-	std::string equipStr = client->PopEquip();
-	if (player && equipManager && equipStr != "") {
-		EquipItem equipItem = parseEquipItem(equipStr);
-		TESForm * form = LookupFormByID(equipItem.TESFormId);
-		if (form) {
-			std::stringstream formIdAsHex;
-
-			switch (equipItem.itemType) {
-			case 1: // Item
-				if (equipItem.hand == kSlotId_Both) {
-					Equipper::EquipItem(player, form, equipItem.itemId, kSlotId_Right);
-					Equipper::EquipItem(player, form, equipItem.itemId, kSlotId_Left);
-				} else {
-					Equipper::EquipItem(player, form, equipItem.itemId, equipItem.hand);
-				}
-				break;
-			case 2: // Spell
-				formIdAsHex << std::hex << equipItem.TESFormId;
-				if (equipItem.hand == kSlotId_Both) {
-					client->EnqueueCommand("player.equipspell " + formIdAsHex.str() + " left");
-					client->EnqueueCommand("player.equipspell " + formIdAsHex.str() + " right");
-				} else {
-					std::string hand = equipItem.hand == 1 ? "right" : "left";
-					client->EnqueueCommand("player.equipspell " + formIdAsHex.str() + " " + hand);
-				}
-				break;
-			case 3: // Shout
-				formIdAsHex << std::hex << equipItem.TESFormId;
-				client->EnqueueCommand("player.equipshout " + formIdAsHex.str());
-				break;
+
+	// Drain everything pending, equips spoken back to back are applied in the same frame
+	equipBatch.clear();
+	client->PopEquips(equipBatch);
+	if (equipBatch.empty() || !player || !equipManager) {
+		return;
+	}
+
+	// Later equips take the slots of earlier ones, an equip without any slot left is dropped.
+	// The engine resolves conflicting equips of the same frame in its own order, so the last one must be the only one.
+	// An earlier equip sharing a hand is dropped, unless it asked for both hands and can keep the other one.
+	pendingEquips.clear();
+	for (size_t i = 0; i < equipBatch.size(); i++) {
+		EquipMetadata metadata;
+		if (!Equipper::GetEquipMetadata(equipBatch[i].TESFormId, metadata)) {
+			continue;
+		}
+
+		UInt64 slots = GetEquipSlots(equipBatch[i], metadata);
+		for (size_t j = 0; j < pendingEquips.size(); j++) {
+			PendingEquip &earlier = pendingEquips[j];
+			earlier.remainingSlots &= ~slots;
+			if ((earlier.slots & slots & kEquipSlot_Hands) != 0 && !CanMoveToOneHand(earlier)) {
+				earlier.remainingSlots = 0;
 			}
 		}
 
+		PendingEquip pending = { equipBatch[i], metadata, slots, slots };
+		pendingEquips.push_back(pending);
 	}
-}
 
+	UInt64 receivedTime = equipBatch.front().receivedTime;
+	size_t equippedCount = 0;
 
+	for (size_t i = 0; i < pendingEquips.size(); i++) {
+		PendingEquip &pending = pendingEquips[i];
+		EquipItem &equipItem = pending.item;
+		const EquipMetadata &metadata = pending.metadata;
 
+		if (pending.slots != 0 && pending.remainingSlots == 0) {
+			continue;
+		}
+
+		// Both hands requested but one of them was taken by a later equip
+		if (equipItem.hand == kSlotId_Both && CanMoveToOneHand(pending)) {
+			if ((pending.remainingSlots & kEquipSlot_Left) == 0) {
+				equipItem.hand = kSlotId_Right;
+			}
+			else if ((pending.remainingSlots & kEquipSlot_Right) == 0) {
+				equipItem.hand = kSlotId_Left;
+			}
+		}
+
+		switch (equipItem.itemType) {
+		case 1: // Item
+			if (equipItem.hand == kSlotId_Both) {
+				Equipper::EquipItem(player, metadata, equipItem.itemId, kSlotId_Right);
+				Equipper::EquipItem(player, metadata, equipItem.itemId, kSlotId_Left);
+			} else {
+				Equipper::EquipItem(player, metadata, equipItem.itemId, equipItem.hand);
+			}
+			break;
+		case 2: // Spell
+			if (equipItem.hand == kSlotId_Both) {
+				RunEquipCommand("player.equipspell", equipItem.TESFormId, " left");
+				RunEquipCommand("player.equipspell", equipItem.TESFormId, " right");
+			} else {
+				RunEquipCommand("player.equipspell", equipItem.TESFormId, equipItem.hand == kSlotId_Right ? " right" : " left");
+			}
+			break;
+		case 3: // Shout
+			RunEquipCommand("player.equipshout", equipItem.TESFormId, "");
+			break;
+		}
+		equippedCount++;
+	}
+
+	Log::infof("Equipped %zu of %zu items, latency %lluus", equippedCount, equipBatch.size(), GetTimeMicroseconds() - receivedTime);
+}
@@ -2,8 +2,16 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
 #include "common/IPrefix.h"
 #include "skse64/GameTypes.h"
+#include "SpeechRecognitionClient.h"
+#include "Equipper.h"
+
+class TESForm;
+class InventoryEntryData;
 
 struct FakeMagicFavorites {
 	UInt64 vtable;
@@ -15,16 +23,59 @@ struct FakeMagicFavorites {
 struct FavoriteMenuItem {
 	UInt32 TESFormId;
 	SInt32 itemId;
-	std::string fullname;
+	UInt32 nameId;	// Index in FavoriteNamePool, equal names have equal ids
 	UInt8 itemType;
 	bool isHanded;	// True if user must specify "left" or "right" in equip commands
+
+	bool operator==(const FavoriteMenuItem &r) const {
+		return TESFormId == r.TESFormId && itemId == r.itemId && nameId == r.nameId &&
+			itemType == r.itemType && isHanded == r.isHanded;
+	}
 };
 
-struct EquipItem {
-	UInt32 TESFormId;
-	SInt32 itemId;
-	UInt8 itemType;
-	SInt32 hand; // 0 = both, 1 = right hand, 2 = left hand
+// Interned names of the favorites, equal names are stored once and compared by id.
+// Cleared when a game is loaded, and rebuilt by CompactNames once most names are unused.
+class FavoriteNamePool {
+public:
+	UInt32 Intern(const char* name);
+	const std::string& Get(UInt32 nameId) const { return names[nameId]; }
+	size_t size() const { return names.size(); }
+	void Swap(FavoriteNamePool &other);
+	void Clear();
+
+private:
+	std::vector<std::string> names;
+	std::unordered_multimap<UInt32 /* CRC32 of name */, UInt32 /* nameId */> index;
+};
+
+// Favorites in the order they are sent, one column per field
+struct FavoritesTable {
+	std::vector<UInt32> formIds;
+	std::vector<SInt32> itemIds;
+	std::vector<UInt32> nameIds;
+	std::vector<UInt8> itemTypes;
+	std::vector<UInt8> isHanded;
+
+	size_t size() const { return formIds.size(); }
+	bool empty() const { return formIds.empty(); }
+	// Keeps the capacity of the columns
+	void clear();
+	void push_back(const FavoriteMenuItem &item);
+};
+
+// Hotkeyed stacks of an inventory item
+struct FavoriteEquipment {
+	UInt32 generation;	// The refresh in which the item was last seen
+	UInt32 hotkeyCount;	// Hotkeyed stacks when extracted, stacks without a name have no item
+	std::vector<FavoriteMenuItem> items;
+};
+
+// An equip of the current batch and the slots it will occupy
+struct PendingEquip {
+	EquipItem item;
+	EquipMetadata metadata;
+	UInt64 slots;			// Slots the item occupies
+	UInt64 remainingSlots;	// Slots not taken by later equips of the batch
 };
 
 class FavoritesMenuManager
@@ -33,11 +84,62 @@ class FavoritesMenuManager
 
 public:
 	static FavoritesMenuManager* getInstance();
+
+	// Rescan the whole inventory and magic favorites. Used when a game is loaded.
+	void ReloadFavorites();
+	// Request an update of the favorites whose hotkeys were set or cleared since the last refresh.
+	// The update is done by ProcessChangedItems once no item menu is open, a menu session is walked once.
+	// Only items whose hotkey count changed or that were marked as changed are extracted again.
 	void RefreshFavorites();
 	void ClearFavorites();
+	// Send the favorites saved in the last session, so the service can prepare their grammars
+	// before the first game is loaded. The real favorites are sent once the player is loaded.
+	void SendSnapshot();
+	// Body of the snapshot writer thread, writes the snapshots saved by SaveSnapshot
+	void WriteSnapshots();
+
+	// Mark an inventory item as added or removed, called by the container changed event.
+	// Can be called from any thread.
+	void MarkItemChanged(UInt32 formId);
+	// Update the items marked as changed, or all favorites if a refresh is pending
+	void ProcessChangedItems();
+
+	// Equip all pending items at once. When several equips target the same slot, the last one wins.
 	void ProcessEquipCommands();
 private:
 	FavoritesMenuManager();
-	std::vector<FavoriteMenuItem> favorites;
+	void UpdateFavorites(bool forceSend);
+	bool UpdateEquipment(UInt32 formId, InventoryEntryData * inv);
+	bool UpdateSpells();
+	UInt64 FingerprintFavorites();
+	void SendFavorites(UInt64 beginTime, UInt64 fingerprint);
+	void SaveSnapshot(const std::string &command);
+	void TakeChangedItems();
+	bool CompactNames();
+
+	std::mutex favoritesLock;
+	UInt32 generation = 0;
+	std::map<UInt32 /* formId */, FavoriteEquipment> equipmentFavorites;
+	std::vector<TESForm*> spellForms;
+	std::vector<FavoriteMenuItem> spellFavorites;
+	FavoriteNamePool names;
+	std::vector<FavoriteMenuItem> extractedItems;	// Reused by UpdateEquipment
+	FavoritesTable favorites;
+	std::string commandBuffer;
 	std::string lastFavoritesCommand;
+	UInt64 lastFavoritesFingerprint = 0;	// 0 if unknown, name ids are only comparable within a pool.
+											// Order-sensitive, see FingerprintFavorites
+
+	std::mutex snapshotLock;
+	std::string pendingSnapshot;	// Latest command to write, guarded by snapshotLock
+	HANDLE snapshotEvent = NULL;	// Signaled when pendingSnapshot is set, the writer thread is started with it
+	std::mutex snapshotFileLock;
+
+	std::vector<EquipItem> equipBatch;
+	std::vector<PendingEquip> pendingEquips;
+
+	std::mutex changedItemsLock;
+	std::vector<UInt32 /* formId */> changedItems;
+	bool isRefreshPending = false;	// Set by RefreshFavorites, guarded by changedItemsLock
+	std::vector<UInt32 /* formId */> takenItems;	// Sorted changed items being updated, guarded by favoritesLock
 };
\ No newline at end of file
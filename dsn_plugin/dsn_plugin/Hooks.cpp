@@ -8,6 +8,7 @@
 #include "skse64/ScaleformValue.h"
 #include "skse64/GameEvents.h"
 #include "skse64/GameInput.h"
+#include "skse64/GameMenus.h"
 #include "skse64_common/BranchTrampoline.h"
 #include "xbyak.h"
 #include "SkyrimType.h"
@@ -15,6 +16,7 @@
 #include "Log.h"
 #include "ConsoleCommandRunner.h"
 #include "FavoritesMenuManager.h"
+#include "Equipper.h"
 
 static GFxMovieView* dialogueMenu = NULL;
 static int desiredTopicIndex = 1;
@@ -73,9 +75,10 @@ static void __cdecl Hook_Loop()
 		std::string command = SpeechRecognitionClient::getInstance()->PopCommand();
 		if (command != "") {
 			ConsoleCommandRunner::RunCommand(command);
-			Log::info("run command: " + command);
+			Log::infof("run command: %s", command.c_str());
 		}
 
+			FavoritesMenuManager::getInstance()->ProcessChangedItems();
 			FavoritesMenuManager::getInstance()->ProcessEquipCommands();
 		}
 	}
@@ -91,7 +94,7 @@ class ObjectLoadedSink : public BSTEventSink<TESObjectLoadedEvent> {
 	EventResult ReceiveEvent(TESObjectLoadedEvent* evn, EventDispatcher<TESObjectLoadedEvent>* dispatcher) override {
 		if (evn != nullptr && evn->formId==0x00000014 /*player*/) {
 			if (evn->loaded) {
-				FavoritesMenuManager::getInstance()->RefreshFavorites();
+				FavoritesMenuManager::getInstance()->ReloadFavorites();
 				Log::info("Favorites Menu Voice-Equip Initialized");
         //InitDebugEventSink();
 			}
@@ -105,10 +108,22 @@ class ObjectLoadedSink : public BSTEventSink<TESObjectLoadedEvent> {
 };
 
 
+class ContainerChangedSink : public BSTEventSink<TESContainerChangedEvent> {
+	EventResult ReceiveEvent(TESContainerChangedEvent* evn, EventDispatcher<TESContainerChangedEvent>* dispatcher) override {
+		if (evn != nullptr && (evn->fromFormId == 0x00000014 || evn->toFormId == 0x00000014) /*player*/) {
+			// Only mark it here, a burst of events (such as taking all from a chest) will be updated once
+			FavoritesMenuManager::getInstance()->MarkItemChanged(evn->itemFormId);
+			// The stacks of the item may have been deleted or merged
+			Equipper::InvalidateInventoryItem(evn->itemFormId);
+		}
+		return kEvent_Continue;
+	}
+};
+
 class PostLoadSink : public BSTEventSink<void> {
 public:
 	EventResult ReceiveEvent(void* evn, EventDispatcher<void>* dispatcher) override {
-		FavoritesMenuManager::getInstance()->RefreshFavorites();
+		FavoritesMenuManager::getInstance()->ReloadFavorites();
 		Log::info("Favorites Menu Voice-Equip Updated");
 		return kEvent_Continue;
 	}
@@ -256,6 +271,20 @@ static void InitDebugEventSink() {
   //static DebugEventSink<TESUniqueIDChangeEvent>          uniqueIdChangeDispatcher("uniqueIdChangeDispatcher");	GetEventDispatcherList()->uniqueIdChangeDispatcher.AddEventSink(&uniqueIdChangeDispatcher);
 }
 
+// Hotkeys are only set or cleared in these menus, the HUD and the other menus
+// also send UpdatePlayerInfo but can't change the favorites
+static bool IsHotkeyMenu(GFxMovieView* movie)
+{
+	MenuManager *menuManager = MenuManager::GetSingleton();
+	UIStringHolder *strings = UIStringHolder::GetSingleton();
+	if (!menuManager || !strings || !movie) {
+		return false;
+	}
+	return movie == menuManager->GetMovieView(&strings->favoritesMenu)
+		|| movie == menuManager->GetMovieView(&strings->inventoryMenu)
+		|| movie == menuManager->GetMovieView(&strings->magicMenu);
+}
+
 static void __cdecl Hook_Invoke(GFxMovieView* movie, char * gfxMethod, GFxValue* argv, UInt32 argc)
 {
 #ifndef IS_VR
@@ -277,6 +306,22 @@ static void __cdecl Hook_Invoke(GFxMovieView* movie, char * gfxMethod, GFxValue*
 	}
 #endif
 
+	// GetEventDispatcherList() is a RelocAddr with a VR address, so the inventory
+	// changes are followed in both versions
+	static bool containerChangedInited = false;
+	if (!containerChangedInited) {
+		static ContainerChangedSink containerChangedSink;
+		GetEventDispatcherList()->unk370.AddEventSink(&containerChangedSink);
+		containerChangedInited = true;
+	}
+
+	// The main window exists once the UI is invoking, resolve it for the switchwindow command
+	static bool skyrimWindowResolved = false;
+	if (!skyrimWindowResolved) {
+		ConsoleCommandRunner::ResolveSkyrimWindow();
+		skyrimWindowResolved = true;
+	}
+
 	if (argc >= 1)
 	{
 		GFxValue commandVal = argv[0];
@@ -300,7 +345,7 @@ static void __cdecl Hook_Invoke(GFxMovieView* movie, char * gfxMethod, GFxValue*
 				dialogueList.lines = lines;
 				SpeechRecognitionClient::getInstance()->StartDialogue(dialogueList);
 			}
-			else if (strcmp(command, "UpdatePlayerInfo") == 0)
+			else if (strcmp(command, "UpdatePlayerInfo") == 0 && IsHotkeyMenu(movie))
 			{
 				FavoritesMenuManager::getInstance()->RefreshFavorites();
 			}
@@ -310,7 +355,7 @@ static void __cdecl Hook_Invoke(GFxMovieView* movie, char * gfxMethod, GFxValue*
 
 // VR Only
 static void __cdecl Hook_PostLoad() {
-	FavoritesMenuManager::getInstance()->RefreshFavorites();
+	FavoritesMenuManager::getInstance()->ReloadFavorites();
 	Log::info("Favorites Menu Voice-Equip Initialized");
   //InitDebugEventSink();
 }
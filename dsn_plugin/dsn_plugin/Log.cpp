@@ -1,67 +1,239 @@
 #include "Log.h"
-#include <sstream>
-#include <fstream>
-#include <windows.h>
-#include <ShlObj.h>
-
-Log* Log::instance = NULL;
-
-Log::Log()
-{
-	std::string baseDir = "";
-
-	{
-		CHAR myDocuments[MAX_PATH];
-		HRESULT result = SHGetFolderPathA(NULL, CSIDL_MYDOCUMENTS, NULL, SHGFP_TYPE_CURRENT, myDocuments);
-
-		if (result == S_OK) {
-			baseDir = std::string(myDocuments) + "/DragonbornSpeaksNaturally";
-			// create dir
-			SHCreateDirectoryEx(NULL, baseDir.c_str(), NULL);
-			baseDir += "/";
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <Windows.h>
+#include "PathUtils.hpp"
+
+namespace {
+	// Power of two, positions are masked into the ring
+	const size_t kSlotCount = 512;
+	const size_t kSlotSize = 1024;
+	const DWORD kFlushIntervalMs = 50;
+	// Replaces the end of a truncated message
+	const char kTruncationMarker[] = "...";
+	const size_t kTruncationMarkerLength = sizeof(kTruncationMarker) - 1;
+
+	// The slot of position pos is free when sequence == 2 * lap, and holds a message when sequence == 2 * lap + 1,
+	// with lap = pos / kSlotCount. Zero initialized, so it works before any constructor runs.
+	struct LogSlot {
+		std::atomic<size_t> sequence;
+		size_t length;
+		char text[kSlotSize];
+	};
+
+	LogSlot slots[kSlotCount];
+	std::atomic<size_t> enqueuePos(0);
+
+	// Single consumer: the writer thread, or DLL_PROCESS_DETACH
+	std::atomic_flag consumerLock = ATOMIC_FLAG_INIT;
+	size_t dequeuePos = 0;
+	HANDLE logFile = INVALID_HANDLE_VALUE;
+	char fileBuffer[64 * 1024];
+	size_t fileBufferLength = 0;
+
+	std::atomic<bool> isStopping(false);
+	HANDLE writerThread = NULL;
+	LPTOP_LEVEL_EXCEPTION_FILTER previousExceptionFilter = NULL;
+
+	std::atomic<UInt64> messageCount(0);
+	std::atomic<UInt64> droppedCount(0);
+	std::atomic<UInt64> callTicks(0);
+	UInt64 reportedDroppedCount = 0;
+
+	UInt64 GetTicks() {
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return counter.QuadPart;
+	}
+
+	// Returns nullptr when the ring is full, the message is dropped rather than blocking the game
+	LogSlot* ClaimSlot(size_t& pos) {
+		pos = enqueuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			LogSlot& slot = slots[pos & (kSlotCount - 1)];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			size_t free = 2 * (pos / kSlotCount);
+			if (sequence == free) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					return &slot;
+				}
+				// pos was reloaded by the failed exchange
+			} else if (sequence < free) {
+				return nullptr;
+			} else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void PublishSlot(LogSlot* slot, size_t pos) {
+		slot->sequence.store(2 * (pos / kSlotCount) + 1, std::memory_order_release);
+	}
+
+	void FlushFileBuffer() {
+		if (fileBufferLength == 0) {
+			return;
+		}
+		if (logFile == INVALID_HANDLE_VALUE) {
+			std::string path = GetUserDataDirectory() + "dragonborn_speaks.log";
+			logFile = CreateFileA(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		}
+		if (logFile != INVALID_HANDLE_VALUE) {
+			DWORD written = 0;
+			WriteFile(logFile, fileBuffer, (DWORD)fileBufferLength, &written, NULL);
+		}
+		fileBufferLength = 0;
+	}
+
+	void AppendLine(const char* text, size_t length) {
+		if (fileBufferLength + length + 2 > sizeof(fileBuffer)) {
+			FlushFileBuffer();
+		}
+		memcpy(fileBuffer + fileBufferLength, text, length);
+		fileBufferLength += length;
+		fileBuffer[fileBufferLength++] = '\r';
+		fileBuffer[fileBufferLength++] = '\n';
+	}
+
+	// Must hold consumerLock
+	void DrainSlots() {
+		for (;;) {
+			LogSlot& slot = slots[dequeuePos & (kSlotCount - 1)];
+			size_t lap = dequeuePos / kSlotCount;
+			if (slot.sequence.load(std::memory_order_acquire) != 2 * lap + 1) {
+				break;
+			}
+			AppendLine(slot.text, slot.length);
+			slot.sequence.store(2 * (lap + 1), std::memory_order_release);
+			dequeuePos++;
+		}
+
+		UInt64 dropped = droppedCount.load(std::memory_order_relaxed);
+		if (dropped != reportedDroppedCount) {
+			char text[64];
+			int length = sprintf_s(text, "%llu log messages dropped", dropped - reportedDroppedCount);
+			AppendLine(text, length > 0 ? length : 0);
+			reportedDroppedCount = dropped;
+		}
+		FlushFileBuffer();
+	}
+
+	void MarkTruncated(LogSlot* slot) {
+		memcpy(slot->text + slot->length - kTruncationMarkerLength, kTruncationMarker, kTruncationMarkerLength);
+	}
+
+	LONG WINAPI FlushOnCrash(EXCEPTION_POINTERS* exceptionInfo) {
+		// Don't wait for the lock, its owner may be the crashed thread
+		if (!consumerLock.test_and_set(std::memory_order_acquire)) {
+			DrainSlots();
+			consumerLock.clear(std::memory_order_release);
 		}
+		return previousExceptionFilter ? previousExceptionFilter(exceptionInfo) : EXCEPTION_CONTINUE_SEARCH;
 	}
 
-	logFile.open(baseDir + "dragonborn_speaks.log", std::ios_base::out | std::ios_base::app);
-	if (!logFile) {
-		logEnabled = false;
+	DWORD WINAPI WriterThread(LPVOID) {
+		while (!isStopping.load(std::memory_order_relaxed)) {
+			Sleep(kFlushIntervalMs);
+			if (!consumerLock.test_and_set(std::memory_order_acquire)) {
+				DrainSlots();
+				consumerLock.clear(std::memory_order_release);
+			}
+		}
+		return 0;
 	}
 }
 
-Log::~Log()
-{
-	logFile.close();
+void Log::write(const char* message, size_t length) {
+	UInt64 beginTicks = GetTicks();
+	size_t pos;
+	LogSlot* slot = ClaimSlot(pos);
+	if (slot == nullptr) {
+		droppedCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	slot->length = length < kSlotSize ? length : kSlotSize;
+	memcpy(slot->text, message, slot->length);
+	if (length > kSlotSize) {
+		MarkTruncated(slot);
+	}
+	PublishSlot(slot, pos);
+
+	messageCount.fetch_add(1, std::memory_order_relaxed);
+	callTicks.fetch_add(GetTicks() - beginTicks, std::memory_order_relaxed);
 }
 
-void Log::writeLine(std::string message)
-{
-	if (!logEnabled) {
+void Log::writeFormat(const char* format, va_list args) {
+	UInt64 beginTicks = GetTicks();
+	size_t pos;
+	LogSlot* slot = ClaimSlot(pos);
+	if (slot == nullptr) {
+		droppedCount.fetch_add(1, std::memory_order_relaxed);
 		return;
 	}
-	logFile << message << std::endl;
-	logFile.flush();
+
+	// Returns the untruncated length, or a negative value on error
+	int length = vsnprintf(slot->text, kSlotSize, format, args);
+	if (length < 0) {
+		length = 0;
+	}
+	slot->length = (size_t)length < kSlotSize ? (size_t)length : kSlotSize - 1;
+	if ((size_t)length >= kSlotSize) {
+		MarkTruncated(slot);
+	}
+	PublishSlot(slot, pos);
+
+	messageCount.fetch_add(1, std::memory_order_relaxed);
+	callTicks.fetch_add(GetTicks() - beginTicks, std::memory_order_relaxed);
+}
+
+void Log::start() {
+	if (writerThread == NULL) {
+		writerThread = CreateThread(NULL, 0, WriterThread, NULL, 0, NULL);
+		previousExceptionFilter = SetUnhandledExceptionFilter(FlushOnCrash);
+	}
 }
 
-Log* Log::get() {
-	if (!instance)
-		instance = new Log();
-	return instance;
+void Log::flush() {
+	while (consumerLock.test_and_set(std::memory_order_acquire)) {
+		Sleep(0);
+	}
+	DrainSlots();
+	consumerLock.clear(std::memory_order_release);
 }
 
-void Log::info(std::string message) {
-	get()->writeLine(message);
+void Log::shutdown(bool isProcessTerminating) {
+	isStopping.store(true);
+
+	UInt64 count = messageCount.load();
+	if (count > 0) {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		infof("Log: %llu messages, %llu dropped, %.0f ns per call",
+			count, droppedCount.load(), callTicks.load() * 1e9 / frequency.QuadPart / count);
+	}
+
+	// The writer thread may have been killed while holding the lock when the process terminates
+	int spins = 0;
+	while (consumerLock.test_and_set(std::memory_order_acquire)) {
+		if (isProcessTerminating && ++spins > 100) {
+			break;
+		}
+		Sleep(1);
+	}
+	DrainSlots();
+	if (logFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(logFile);
+		logFile = INVALID_HANDLE_VALUE;
+	}
+	consumerLock.clear(std::memory_order_release);
 }
 
-void Log::address(std::string message, uintptr_t addr) {
-	std::stringstream ss;
-	ss << std::hex << addr;
-	const std::string s = ss.str();
-	Log::info(message.append(s));
+void Log::address(const std::string& message, uintptr_t addr) {
+	infof("%s%llx", message.c_str(), (unsigned long long)addr);
 }
 
-void Log::hex(std::string message, uintptr_t addr) {
-	std::stringstream ss;
-	ss << std::hex << addr;
-	const std::string s = ss.str();
-	Log::info(message.append(s));
-}
\ No newline at end of file
+void Log::hex(const std::string& message, uintptr_t addr) {
+	infof("%s%llx", message.c_str(), (unsigned long long)addr);
+}
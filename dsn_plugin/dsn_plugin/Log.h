@@ -1,24 +1,76 @@
 #pragma once
 #include "common/IPrefix.h"
+#include <cstdarg>
 #include <cstdlib>
 #include <string>
-#include <fstream>
 
+// Messages below this level are compiled out, see DSN_LOG_LEVEL in CMakeLists.txt
+#define DSN_LOG_LEVEL_DEBUG 0
+#define DSN_LOG_LEVEL_INFO 1
+#define DSN_LOG_LEVEL_ERROR 2
+#ifndef DSN_LOG_LEVEL
+#define DSN_LOG_LEVEL DSN_LOG_LEVEL_INFO
+#endif
+
+// Asynchronous log, safe to call from the game thread.
+// A call only formats the message into a preallocated slot of a lock-free ring,
+// a background thread writes the slots to the log file.
+// Errors are written to the file before errorf returns, and the ring is also written
+// if the game crashes, since DLL_PROCESS_DETACH isn't reached then.
 class Log
 {
-	static Log* instance;
+	static void write(const char* message, size_t length);
+	static void writeFormat(const char* format, va_list args);
 
-	bool logEnabled = true;
-	std::ofstream logFile;
+public:
+	// Start the background writer, called once on DLL_PROCESS_ATTACH
+	static void start();
+	// Write the remaining messages, called on DLL_PROCESS_DETACH.
+	// isProcessTerminating: the other threads are already gone.
+	static void shutdown(bool isProcessTerminating);
+	// Write the queued messages on the calling thread
+	static void flush();
 
-	Log();
-	~Log();
-	void writeLine(std::string message);
+	static void info(const std::string& message);
+	// printf-style, messages longer than a slot are truncated and end with "..."
+	static void infof(const char* format, ...);
+	// Also flushes, so the message is in the file even if the game exits right after
+	static void errorf(const char* format, ...);
+	static void debugf(const char* format, ...);
+	static void address(const std::string& message, uintptr_t addr);
+	static void hex(const std::string& message, uintptr_t addr);
+};
 
-public:
-	static Log* get();
+inline void Log::info(const std::string& message) {
+#if DSN_LOG_LEVEL <= DSN_LOG_LEVEL_INFO
+	write(message.c_str(), message.size());
+#endif
+}
+
+inline void Log::infof(const char* format, ...) {
+#if DSN_LOG_LEVEL <= DSN_LOG_LEVEL_INFO
+	va_list args;
+	va_start(args, format);
+	writeFormat(format, args);
+	va_end(args);
+#endif
+}
+
+inline void Log::errorf(const char* format, ...) {
+#if DSN_LOG_LEVEL <= DSN_LOG_LEVEL_ERROR
+	va_list args;
+	va_start(args, format);
+	writeFormat(format, args);
+	va_end(args);
+	flush();
+#endif
+}
 
-	static void info(std::string message);
-	static void address(std::string message, uintptr_t addr);
-	static void hex(std::string message, uintptr_t addr);
-};
\ No newline at end of file
+inline void Log::debugf(const char* format, ...) {
+#if DSN_LOG_LEVEL <= DSN_LOG_LEVEL_DEBUG
+	va_list args;
+	va_start(args, format);
+	writeFormat(format, args);
+	va_end(args);
+#endif
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <Windows.h>
+#include <ShlObj.h>
+
+// Directory for the log and other user data: "My Documents/DragonbornSpeaksNaturally/".
+// Created if missing. Returns an empty string (the working directory) if My Documents can't be found.
+inline static std::string GetUserDataDirectory() {
+	CHAR myDocuments[MAX_PATH];
+	HRESULT result = SHGetFolderPathA(NULL, CSIDL_MYDOCUMENTS, NULL, SHGFP_TYPE_CURRENT, myDocuments);
+	if (result != S_OK) {
+		return "";
+	}
+
+	std::string baseDir = std::string(myDocuments) + "/DragonbornSpeaksNaturally";
+	// create dir
+	SHCreateDirectoryEx(NULL, baseDir.c_str(), NULL);
+	return baseDir + "/";
+}
@@ -1,6 +1,8 @@
 #include "SpeechRecognitionClient.h"
 #include "ConsoleCommandRunner.h"
+#include "FavoritesMenuManager.h"
 #include "Log.h"
+#include "TimeUtils.hpp"
 #include <io.h>
 #include <fcntl.h>
 
@@ -77,15 +79,14 @@ std::string SpeechRecognitionClient::PopCommand() {
 	return retcommand;
 }
 
-std::string SpeechRecognitionClient::PopEquip() {
+void SpeechRecognitionClient::PopEquips(std::vector<EquipItem> &equips) {
 	std::lock_guard<std::mutex> scopeLock(queueLock);
 	if (queuedEquips.empty())
 	{
-		return "";
+		return;
 	}
-	std::string retcommand = queuedEquips.front();
-	queuedEquips.pop();
-	return retcommand;
+	equips.insert(equips.end(), queuedEquips.begin(), queuedEquips.end());
+	queuedEquips.clear();
 }
 
 void SpeechRecognitionClient::EnqueueCommand(std::string command) {
@@ -98,9 +99,47 @@ void SpeechRecognitionClient::EnqueueCommand(std::string command) {
 	queuedCommands.push(command);
 }
 
+// Parse "formId;itemId;itemType;hand"
+static bool parseEquipItem(const std::string &equip, EquipItem &item) {
+	const char* str = equip.c_str();
+	char* end = NULL;
+
+	item.TESFormId = (UInt32)std::strtoul(str, &end, 10);
+	if (end == str || *end != ';') {
+		return false;
+	}
+	str = end + 1;
+
+	item.itemId = (SInt32)std::strtol(str, &end, 10);
+	if (end == str || *end != ';') {
+		return false;
+	}
+	str = end + 1;
+
+	item.itemType = (UInt8)std::strtoul(str, &end, 10);
+	if (end == str || *end != ';') {
+		return false;
+	}
+	str = end + 1;
+
+	item.hand = (SInt32)std::strtol(str, &end, 10);
+	if (end == str) {
+		return false;
+	}
+
+	item.receivedTime = GetTimeMicroseconds();
+	return true;
+}
+
 void SpeechRecognitionClient::EnqueueEquip(std::string equip) {
+	EquipItem item;
+	if (!parseEquipItem(equip, item)) {
+		Log::info("Invalid equip command: " + equip);
+		return;
+	}
+
 	std::lock_guard<std::mutex> scopeLock(queueLock);
-	queuedEquips.push(equip);
+	queuedEquips.push_back(item);
 }
 
 void SpeechRecognitionClient::AwaitResponses() {
@@ -163,6 +202,8 @@ std::string SpeechRecognitionClient::ReadLine() {
 void SpeechRecognitionClient::WriteLine(std::string line) {
 	DWORD dwWritten;
 	line.push_back('\n');
+	// The game thread and the client thread (favorites snapshot) both send, don't interleave their lines
+	std::lock_guard<std::mutex> scopeLock(writeLock);
 	WriteFile(this->stdInWr, line.c_str(), line.length(), &dwWritten, NULL);
 }
 
@@ -223,11 +264,12 @@ static DWORD WINAPI SpeechRecognitionClientThreadStart(void* ctx) {
 	{
 		Log::info("Initialized speech recognition service");
 		SpeechRecognitionClient::getInstance()->SetHandles(g_hChildStd_IN_Wr, g_hChildStd_OUT_Rd);
+		FavoritesMenuManager::getInstance()->SendSnapshot();
 		SpeechRecognitionClient::getInstance()->AwaitResponses();
 	}
 	else
 	{
-		Log::info("Failed to initialize speech recognition service");
+		Log::errorf("Failed to initialize speech recognition service");
 	}
 
 	return 0;
@@ -28,6 +28,15 @@ struct DialogueList
 	}
 };
 
+// EQUIP command from the service, parsed on the reader thread
+struct EquipItem {
+	UInt32 TESFormId;
+	SInt32 itemId;
+	UInt8 itemType;
+	SInt32 hand; // 0 = both, 1 = right hand, 2 = left hand
+	UInt64 receivedTime; // In microseconds, used to measure the equip latency
+};
+
 class SpeechRecognitionClient
 {
 public:
@@ -44,11 +53,13 @@ public:
 	void StopDialogue();
 	void StartDialogue(DialogueList list);
 
+	// Can be called from any thread, lines are written whole
 	void WriteLine(std::string str);
 	int ReadSelectedIndex();
 
 	std::string PopCommand();
-	std::string PopEquip();
+	// Move all pending equips to the end of equips
+	void PopEquips(std::vector<EquipItem> &equips);
 	void EnqueueCommand(std::string command);
 	void EnqueueEquip(std::string equip);
 
@@ -66,7 +77,8 @@ private:
 	int currentDialogueId = 0;
 	DialogueList currentDialogueList;
 	std::string workingLine;
+	std::mutex writeLock;
 	std::mutex queueLock;
 	std::queue<std::string> queuedCommands;
-	std::queue<std::string> queuedEquips;
+	std::vector<EquipItem> queuedEquips;
 };
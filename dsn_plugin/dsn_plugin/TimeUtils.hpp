@@ -0,0 +1,20 @@
+#pragma once
+#include "common/IPrefix.h"
+#include <Windows.h>
+
+// Microseconds elapsed since an arbitrary point (system boot).
+// Used to measure the cost of commands and refreshes.
+inline static UInt64 GetTimeMicroseconds() {
+	static LARGE_INTEGER frequency = { 0 };
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	// Split the division to avoid overflow of counter * 1000000
+	UInt64 seconds = counter.QuadPart / frequency.QuadPart;
+	UInt64 remainder = counter.QuadPart % frequency.QuadPart;
+	return seconds * 1000000 + remainder * 1000000 / frequency.QuadPart;
+}
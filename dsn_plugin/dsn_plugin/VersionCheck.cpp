@@ -187,7 +187,7 @@ bool VersionCheck::IsCompatibleExeVersion() {
 	const UInt64 kSkyrimCurVersion = SKYRIM_VERSION[g_SkyrimType];
 
 	if (version < kSkyrimCurVersion) {
-		Log::info("Error: Skyrim version is out of date, please ensure you're using version " + SKYRIM_VERSION_STR[g_SkyrimType]);
+		Log::errorf("Error: Skyrim version is out of date, please ensure you're using version %s", SKYRIM_VERSION_STR[g_SkyrimType].c_str());
 		Log::hex("Skyrim Version: ", version);
 		return false;
 	}
@@ -29,6 +29,7 @@ extern "C"	{
 		switch (fdwReason)
 		{
 		case DLL_PROCESS_ATTACH:
+			Log::start();
 
 			if (!VersionCheck::IsCompatibleExeVersion()) {
 				return TRUE;
@@ -58,6 +59,8 @@ extern "C"	{
 
 		case DLL_PROCESS_DETACH:
 			// Perform any necessary cleanup.
+			// lpReserved is not NULL when the process is terminating
+			Log::shutdown(lpReserved != NULL);
 			break;
 		}
 		return TRUE;  // Successful DLL_PROCESS_ATTACH.
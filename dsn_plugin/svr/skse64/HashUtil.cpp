@@ -1,4 +1,5 @@
 #include "HashUtil.h"
+#include <cstring>
 
 static const UInt32 s_crc32Lookup[256] =
 {
@@ -36,15 +37,58 @@ static const UInt32 s_crc32Lookup[256] =
 	0xB3667A2E,0xC4614AB8,0x5D681B02,0x2A6F2B94,0xB40BBE37,0xC30C8EA1,0x5A05DF1B,0x2D02EF8D
 };
 
+// Slicing-by-8 tables, s_crc32Slices[0] is the same as s_crc32Lookup.
+// s_crc32Slices[k][i] is the CRC of byte i followed by k zero bytes.
+struct CRC32Slices
+{
+	UInt32 table[8][256];
+
+	CRC32Slices()
+	{
+		for (UInt32 i = 0; i < 256; i++)
+			table[0][i] = s_crc32Lookup[i];
+
+		for (UInt32 k = 1; k < 8; k++)
+			for (UInt32 i = 0; i < 256; i++)
+				table[k][i] = (table[k - 1][i] >> 8) ^ s_crc32Lookup[table[k - 1][i] & 0xFF];
+	}
+};
+
+// Built on first use to avoid depending on static initialization order
+static const CRC32Slices& GetCRC32Slices()
+{
+	static const CRC32Slices slices;
+	return slices;
+}
+
 namespace HashUtil
 {
 	UInt32 CRC32(const char* str, UInt32 start)
 	{
+		return CRC32(str, strlen(str), start);
+	}
+
+	UInt32 CRC32(const char* str, size_t len, UInt32 start)
+	{
+		const UInt32 (&t)[8][256] = GetCRC32Slices().table;
 		UInt32 result = ~start;
-		unsigned char* c = (unsigned char*) str;
-		size_t len = strlen(str);
+		const unsigned char* c = (const unsigned char*) str;
+
+		// 8 bytes per step (little endian)
+		while (len >= 8)
+		{
+			UInt32 lo, hi;
+			memcpy(&lo, c, 4);
+			memcpy(&hi, c + 4, 4);
+			lo ^= result;
+			result = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+				t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+			c += 8;
+			len -= 8;
+		}
+
 		while (len-- > 0)
-			result = (result >> 8) ^ s_crc32Lookup[(result & 0xFF) ^ *c++];
+			result = (result >> 8) ^ t[0][(result & 0xFF) ^ *c++];
 		return ~result;
 	}
 }
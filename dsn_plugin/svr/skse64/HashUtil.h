@@ -4,4 +4,7 @@ namespace HashUtil
 {
 	// Calc CRC32 of null terminated string
 	UInt32 CRC32(const char* str, UInt32 start = 0);
+
+	// Calc CRC32 of a string with known length, same result as above without strlen
+	UInt32 CRC32(const char* str, size_t len, UInt32 start);
 }
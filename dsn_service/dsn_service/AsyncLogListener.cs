@@ -0,0 +1,262 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Text;
+using System.Threading;
+
+namespace DSN {
+    // Trace listener that only queues the messages, a background thread writes them in batches.
+    // Recognition and input threads no longer wait for the log file.
+    // Errors are written and flushed on the calling thread, with the messages queued before them,
+    // so they are in the file even if the process dies right after.
+    class AsyncLogListener : TraceListener {
+        // Messages beyond this are dropped rather than blocking the caller
+        private const int QUEUE_CAPACITY = 10000;
+        private const int MAX_BATCH_SIZE = 512;
+
+        private readonly string path;
+        private readonly BlockingCollection<string> queue = new BlockingCollection<string>(QUEUE_CAPACITY);
+        private readonly Thread writerThread;
+        // Guards the writer, used by the writer thread and by synchronous writes
+        private readonly Object writerLock = new Object();
+        private StreamWriter writer;
+
+        private volatile TraceEventType minimumLevel = TraceEventType.Verbose;
+        private volatile HashSet<string> disabledCategories = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
+        private long maxFileSize = 10 * 1024 * 1024;
+        private int maxFiles = 3;
+
+        private long messageCount = 0;
+        private long droppedCount = 0;
+        private long enqueueTicks = 0;
+
+        public AsyncLogListener(string path) {
+            this.path = path;
+            writer = OpenWriter();
+
+            writerThread = new Thread(WriteMessages);
+            writerThread.Name = "Log writer";
+            writerThread.IsBackground = true;
+            writerThread.Start();
+        }
+
+        public override bool IsThreadSafe {
+            get { return true; }
+        }
+
+        // minimumLevel: Error, Warning, Information or Verbose. disabledCategories: categories of Log.Verbose not written.
+        // maxFileSize: in bytes, the log is rotated to .1, .2... when it is larger.
+        public void Configure(TraceEventType minimumLevel, IEnumerable<string> disabledCategories, long maxFileSize, int maxFiles) {
+            this.minimumLevel = minimumLevel;
+            this.disabledCategories = new HashSet<string>(disabledCategories, StringComparer.OrdinalIgnoreCase);
+            Interlocked.Exchange(ref this.maxFileSize, maxFileSize);
+            Interlocked.Exchange(ref this.maxFiles, maxFiles);
+        }
+
+        // Lower TraceEventType values are more severe
+        public bool IsEnabled(TraceEventType level, string category) {
+            return level <= minimumLevel && (category == null || !disabledCategories.Contains(category));
+        }
+
+        public override void TraceEvent(TraceEventCache eventCache, string source, TraceEventType eventType, int id) {
+            TraceEvent(eventCache, source, eventType, id, "");
+        }
+
+        public override void TraceEvent(TraceEventCache eventCache, string source, TraceEventType eventType, int id, string message) {
+            if (IsEnabled(eventType, null)) {
+                Enqueue(eventType, null, message);
+            }
+        }
+
+        public override void TraceEvent(TraceEventCache eventCache, string source, TraceEventType eventType, int id, string format, params object[] args) {
+            if (IsEnabled(eventType, null)) {
+                Enqueue(eventType, null, args == null || args.Length == 0 ? format : string.Format(format, args));
+            }
+        }
+
+        public override void Write(string message) {
+            WriteLine(message);
+        }
+
+        public override void WriteLine(string message) {
+            if (IsEnabled(TraceEventType.Verbose, null)) {
+                Enqueue(TraceEventType.Verbose, null, message);
+            }
+        }
+
+        public override void WriteLine(string message, string category) {
+            if (IsEnabled(TraceEventType.Verbose, category)) {
+                Enqueue(TraceEventType.Verbose, category, message);
+            }
+        }
+
+        private void Enqueue(TraceEventType level, string category, string message) {
+            long start = Stopwatch.GetTimestamp();
+
+            StringBuilder line = new StringBuilder(message.Length + 48);
+            line.Append(DateTime.Now.ToString("yyyy-MM-dd HH:mm:ss.fff")).Append(' ').Append(level).Append(": ");
+            if (category != null) {
+                line.Append('[').Append(category).Append("] ");
+            }
+            line.Append(message);
+
+            if (level <= TraceEventType.Error) {
+                WriteSynchronously(line.ToString());
+            } else {
+                try {
+                    if (!queue.TryAdd(line.ToString())) {
+                        Interlocked.Increment(ref droppedCount);
+                    }
+                } catch (InvalidOperationException) {
+                    // Adding was completed by Shutdown, the writer thread is gone
+                    WriteSynchronously(line.ToString());
+                }
+            }
+
+            Interlocked.Increment(ref messageCount);
+            Interlocked.Add(ref enqueueTicks, Stopwatch.GetTimestamp() - start);
+        }
+
+        private void WriteMessages() {
+            foreach (string first in queue.GetConsumingEnumerable()) {
+                // A failed batch must not stop the thread, the next one is written to a reopened file
+                lock (writerLock) {
+                    try {
+                        if (writer == null) {
+                            writer = OpenWriter();
+                        }
+                        WriteLineToFile(first);
+                        string line;
+                        for (int i = 1; i < MAX_BATCH_SIZE && queue.TryTake(out line); i++) {
+                            WriteLineToFile(line);
+                        }
+                        FlushWriter();
+                    } catch (Exception ex) {
+                        Console.Error.WriteLine("Failed to write log batch to " + path + ": {0}", ex.ToString());
+                        ReopenWriter();
+                    }
+                }
+            }
+        }
+
+        // Writes the queued messages and then the line, and flushes the file before returning
+        private void WriteSynchronously(string line) {
+            lock (writerLock) {
+                try {
+                    DrainQueue();
+                    WriteLineToFile(line);
+                } catch (Exception ex) {
+                    Console.Error.WriteLine("Failed to write log file " + path + ": {0}", ex.ToString());
+                    ReopenWriter();
+                }
+                FlushWriter();
+            }
+        }
+
+        // Writes the queued messages and flushes the file before returning.
+        // Called by Trace.Flush() and before the process exits.
+        public override void Flush() {
+            lock (writerLock) {
+                DrainQueue();
+                FlushWriter();
+            }
+        }
+
+        private void DrainQueue() {
+            string line;
+            while (queue.TryTake(out line)) {
+                WriteLineToFile(line);
+            }
+        }
+
+        private void FlushWriter() {
+            try {
+                if (writer != null) {
+                    writer.Flush();
+                }
+                RotateIfNeeded();
+            } catch (Exception ex) {
+                Console.Error.WriteLine("Failed to flush log file " + path + ": {0}", ex.ToString());
+                ReopenWriter();
+            }
+        }
+
+        private void WriteLineToFile(string line) {
+            if (writer == null) {
+                return;
+            }
+            try {
+                writer.WriteLine(line);
+            } catch (Exception ex) {
+                Console.Error.WriteLine("Failed to write log file " + path + ": {0}", ex.ToString());
+                ReopenWriter();
+            }
+        }
+
+        // The writer may be left broken by a failed write, such as a full disk or a file locked by another process
+        private void ReopenWriter() {
+            if (writer != null) {
+                try {
+                    writer.Dispose();
+                } catch (Exception) {
+                    // Its buffered lines are lost with it
+                }
+            }
+            writer = OpenWriter();
+        }
+
+        private StreamWriter OpenWriter() {
+            try {
+                return new StreamWriter(path, true, new UTF8Encoding(false));
+            } catch (Exception ex) {
+                Console.Error.WriteLine("Failed to open log file at " + path + ": {0}", ex.ToString());
+                return null;
+            }
+        }
+
+        private void RotateIfNeeded() {
+            if (writer == null || writer.BaseStream.Length <= Interlocked.Read(ref maxFileSize)) {
+                return;
+            }
+
+            writer.Dispose();
+            try {
+                int files = Math.Max(maxFiles, 1);
+                File.Delete(path + "." + files);
+                for (int i = files - 1; i >= 1; i--) {
+                    if (File.Exists(path + "." + i)) {
+                        File.Move(path + "." + i, path + "." + (i + 1));
+                    }
+                }
+                File.Move(path, path + ".1");
+            } catch (Exception ex) {
+                Console.Error.WriteLine("Failed to rotate log file " + path + ": {0}", ex.ToString());
+            }
+            writer = OpenWriter();
+        }
+
+        // Writes the queued messages, waiting at most timeout
+        public void Shutdown(TimeSpan timeout) {
+            long count = Interlocked.Read(ref messageCount);
+            if (count > 0) {
+                double averageMicroseconds = Interlocked.Read(ref enqueueTicks) * 1000000.0 / Stopwatch.Frequency / count;
+                Enqueue(TraceEventType.Information, null, string.Format(
+                    "Log: {0} messages, {1} dropped, {2:0.00} us per message on the calling thread",
+                    count, Interlocked.Read(ref droppedCount), averageMicroseconds));
+            }
+
+            queue.CompleteAdding();
+            writerThread.Join(timeout);
+            lock (writerLock) {
+                // Messages the writer thread didn't get to in time
+                DrainQueue();
+                if (writer != null) {
+                    writer.Dispose();
+                    writer = null;
+                }
+            }
+        }
+    }
+}
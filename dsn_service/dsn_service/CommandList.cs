@@ -15,49 +15,82 @@ namespace DSN {
     class CommandList : ISpeechRecognitionGrammarProvider {
 
         public static CommandList FromIniSection(IniData ini, string sectionName, Configuration config) {
+            Stopwatch watch = Stopwatch.StartNew();
+            int srgsHits = SrgsGrammarCache.Hits, srgsMisses = SrgsGrammarCache.Misses;
+
             KeyDataCollection sectionData = ini.Sections[sectionName];
             CommandList list = new CommandList();
+            list.config = config;
             if(sectionData != null) {
+                List<KeyData> keys = new List<KeyData>();
                 foreach(KeyData key in sectionData) {
                     string value = key.Value.Trim();
                     if (value.Length == 0) {
                         Trace.TraceInformation("Ignore empty command '{0}'", key.KeyName);
                         continue;
                     }
-                    Grammar grammar;
-                    if (value[0] == '@') {
-                        string path = config.ResolveFilePath(value.Substring(1));
-                        if (path == null) {
-                            Trace.TraceError("Cannot find the SRGS XML file '{0}', key: {1}", value.Substring(1), key.KeyName);
-                            continue;
-                        }
-
-                        // load a SRGS XML file
-                        XmlDocument doc = new XmlDocument();
-                        doc.Load(path);
+                    keys.Add(key);
+                }
 
-                        // If xml:lang in the file does not match the DSN's locale, the grammar cannot be loaded.
-                        XmlAttribute xmlLang = doc.CreateAttribute("xml:lang");
-                        xmlLang.Value = config.GetLocale().Name;
-                        doc.DocumentElement.SetAttributeNode(xmlLang);
+                // Build the grammars on the thread pool, then add them in the order of the ini file.
+                // Keys using the same SRGS file are compiled once, SrgsGrammarCache serializes them per cache key.
+                Grammar[] grammars = new Grammar[keys.Count];
+                Parallel.For(0, keys.Count, (i) => {
+                    try {
+                        grammars[i] = BuildGrammar(keys[i], config);
+                    } catch (Exception ex) {
+                        Trace.TraceError("Failed to create grammar for command '{0}' due to exception:\n{1}", keys[i].KeyName, ex.ToString());
+                    }
+                });
 
-                        MemoryStream xmlStream = new MemoryStream();
-                        doc.Save(xmlStream);
-                        xmlStream.Flush(); //Adjust this if you want read your data 
-                        xmlStream.Position = 0;
+                for (int i = 0; i < keys.Count; i++) {
+                    if (grammars[i] != null) {
+                        list.commandsByPhrase[grammars[i]] = keys[i].Value.Trim();
+                    }
+                }
 
-                        grammar = new Grammar(xmlStream);
+                // Plain phrases can be matched against a hypothesis.
+                // SRGS grammars are excluded, their semantics may not be complete in a hypothesis.
+                for (int i = 0; i < keys.Count; i++) {
+                    if (grammars[i] == null) {
+                        continue;
+                    }
+                    if (keys[i].Value.Trim()[0] == '@') {
+                        list.hasSrgsGrammars = true;
                     } else {
-                        grammar = Phrases.createGrammar(Phrases.normalize(key.KeyName, config), config);
+                        list.completePhrases[grammars[i]] = Phrases.normalize(keys[i].KeyName, config);
                     }
-                    grammar.Name = key.KeyName;
-                    list.commandsByPhrase[grammar] = value;
                 }
             }
+
+            Trace.TraceInformation("Command list loaded in {0} ms: {1} phrases, {2} compiled SRGS grammars from cache, {3} compiled",
+                watch.ElapsedMilliseconds, list.commandsByPhrase.Count,
+                SrgsGrammarCache.Hits - srgsHits, SrgsGrammarCache.Misses - srgsMisses);
             return list;
         }
 
+        private static Grammar BuildGrammar(KeyData key, Configuration config) {
+            string value = key.Value.Trim();
+            Grammar grammar;
+            if (value[0] == '@') {
+                string path = config.ResolveFilePath(value.Substring(1));
+                if (path == null) {
+                    Trace.TraceError("Cannot find the SRGS XML file '{0}', key: {1}", value.Substring(1), key.KeyName);
+                    return null;
+                }
+
+                grammar = SrgsGrammarCache.Load(path, config);
+            } else {
+                grammar = Phrases.createGrammar(Phrases.normalize(key.KeyName, config), config);
+            }
+            grammar.Name = key.KeyName;
+            return grammar;
+        }
+
         public Dictionary<Grammar, string> commandsByPhrase = new Dictionary<Grammar, string>();
+        private Dictionary<Grammar, string> completePhrases = new Dictionary<Grammar, string>();
+        private bool hasSrgsGrammars = false;
+        private Configuration config;
 
         public string GetCommandForPhrase(Grammar grammar) {
             if (commandsByPhrase.ContainsKey(grammar))
@@ -68,10 +101,24 @@ namespace DSN {
         public void PrintToTrace() {
             Trace.TraceInformation("Command List Phrases:");
             foreach (KeyValuePair<Grammar, string> entry in commandsByPhrase) {
-                Trace.TraceInformation("Phrase '{0}' mapped to commands '{1}'", entry.Key.Name, entry.Value);
+                Log.Verbose("Grammar", "Phrase '{0}' mapped to commands '{1}'", entry.Key.Name, entry.Value);
             }
         }
 
+        // Optional words are not stripped, a hypothesis without them is never complete
+        public bool IsCompletePhrase(RecognitionResult hypothesis, string text) {
+            string phrase;
+            if (!completePhrases.TryGetValue(hypothesis.Grammar, out phrase)) {
+                return false;
+            }
+            return string.Equals(text, phrase, StringComparison.OrdinalIgnoreCase);
+        }
+
+        // An SRGS grammar may accept anything that starts with the text
+        public bool CanExtend(string text) {
+            return hasSrgsGrammars || completePhrases.Values.Any((x) => Phrases.canExtend(x, text, config));
+        }
+
         public List<Grammar> GetGrammars() {
             return commandsByPhrase.Keys.ToList();
         }
@@ -63,6 +63,9 @@ namespace DSN {
         private IniData merged = null;
 
         private List<string> goodbyePhrases = null;
+        private List<Grammar> goodbyeGrammars = null;
+        private GrammarCache dialogueGrammarCache = null;
+        private ItemNameMap itemNameMap = null;
         private List<string> pausePhrases = null;
         private List<string> resumePhrases = null;
         private CommandList consoleCommandList = null;
@@ -76,7 +79,11 @@ namespace DSN {
 
         private CultureInfo locale = CultureInfo.CurrentCulture;
 
-        public Configuration() {
+        public Configuration() : this(null) {
+        }
+
+        // previous: the configuration being reloaded. Its grammars are reused if their sections didn't change.
+        public Configuration(Configuration previous) {
             iniFilePath = ResolveFilePath(CONFIG_FILE_NAMES);
 
             loadLocal();
@@ -125,8 +132,46 @@ namespace DSN {
                 locale = new CultureInfo(localeStr);
             }
 
-            consoleCommandList = CommandList.FromIniSection(merged, "ConsoleCommands", this);
-            consoleCommandList.PrintToTrace();
+            // Grammars also depend on the normalize/optional expressions and the locale in [SpeechRecognition]
+            List<string> changedSections = previous == null ? null : GetChangedSections(previous);
+            bool canReuse = changedSections != null && !changedSections.Contains("SpeechRecognition");
+
+            if (canReuse && !changedSections.Contains("Dialogue")) {
+                dialogueGrammarCache = previous.dialogueGrammarCache;
+                goodbyeGrammars = previous.goodbyeGrammars;
+            } else {
+                dialogueGrammarCache = new GrammarCache(int.Parse(Get("Dialogue", "grammarCacheSize", "512")));
+            }
+
+            if (canReuse && !changedSections.Contains("ConsoleCommands")) {
+                consoleCommandList = previous.consoleCommandList;
+            } else {
+                consoleCommandList = CommandList.FromIniSection(merged, "ConsoleCommands", this);
+                consoleCommandList.PrintToTrace();
+            }
+        }
+
+        // Names of the sections that were added, removed or changed compared with another configuration
+        public List<string> GetChangedSections(Configuration other) {
+            HashSet<string> sectionNames = new HashSet<string>();
+            foreach (SectionData section in merged.Sections) {
+                sectionNames.Add(section.SectionName);
+            }
+            foreach (SectionData section in other.merged.Sections) {
+                sectionNames.Add(section.SectionName);
+            }
+            return sectionNames.Where((x) => getSectionText(merged, x) != getSectionText(other.merged, x)).ToList();
+        }
+
+        private static string getSectionText(IniData ini, string sectionName) {
+            if (!ini.Sections.ContainsSection(sectionName)) {
+                return null;
+            }
+            StringBuilder text = new StringBuilder();
+            foreach (KeyData key in ini.Sections.GetSectionData(sectionName).Keys) {
+                text.Append(key.KeyName).Append('=').Append(key.Value).Append('\n');
+            }
+            return text.ToString();
         }
 
         public void Stop() {
@@ -166,6 +211,26 @@ namespace DSN {
             return goodbyePhrases;
         }
 
+        // Built on first use and shared by all dialogues
+        public List<Grammar> GetGoodbyeGrammars() {
+            if (goodbyeGrammars == null) {
+                goodbyeGrammars = new List<Grammar>();
+                foreach (string phrase in goodbyePhrases) {
+                    Trace.TraceInformation("Found goodbye phrase: '{0}'", phrase);
+                    try {
+                        goodbyeGrammars.Add(Phrases.createGrammar(phrase, this, enableDialogueSubsetMatching));
+                    } catch (Exception ex) {
+                        Trace.TraceError("Failed to create grammar for exit dialogue phrase {0} due to exception:\n{1}", phrase, ex.ToString());
+                    }
+                }
+            }
+            return goodbyeGrammars;
+        }
+
+        public GrammarCache GetDialogueGrammarCache() {
+            return dialogueGrammarCache;
+        }
+
         public List<string> GetPausePhrases() {
             return pausePhrases;
         }
@@ -206,8 +271,12 @@ namespace DSN {
             return locale;
         }
 
-        public string GetItemNameMap() {
-            return ResolveFilePath(ITEM_NAME_MAPS);
+        public ItemNameMap GetItemNameMap() {
+            // The path is resolved once, the map itself reloads when the file changes
+            if (itemNameMap == null) {
+                itemNameMap = new ItemNameMap(ResolveFilePath(ITEM_NAME_MAPS));
+            }
+            return itemNameMap;
         }
 
         private void loadGlobal() {
@@ -224,10 +293,10 @@ namespace DSN {
             foreach (string directory in SEARCH_DIRECTORIES) {
                 string filepath = directory + filename;
                 if (File.Exists(filepath)) {
-                    Trace.TraceInformation("filepath found: " + filepath);
+                    Log.Verbose("File", "filepath found: {0}", filepath);
                     return Path.GetFullPath(filepath); ;
                 }
-                Trace.TraceInformation("filepath not found: " + filepath);
+                Log.Verbose("File", "filepath not found: {0}", filepath);
             }
             return null;
         }
@@ -26,32 +26,29 @@ namespace DSN {
             this.id = id;
             this.config = config;
 
-            List<string> goodbyePhrases = config.GetGoodbyePhrases();
+            GrammarCache cache = config.GetDialogueGrammarCache();
 
             for (int i = 0; i < lines.Count; i++) {
                 string line = lines[i];
                 if (line == null || line.Trim() == "")
                     continue;
                 try {
-                    Grammar g = Phrases.createGrammar(line, config, config.IsSubsetMatchingEnabled());
-                    grammarToIndex[g] = i;
+                    Grammar g = cache.GetOrCreate(line, config, config.IsSubsetMatchingEnabled());
+                    // Identical lines share the grammar, the first one is selected
+                    if (!grammarToIndex.ContainsKey(g)) {
+                        grammarToIndex[g] = i;
+                    }
                 }
                 catch(Exception ex) {
                     Trace.TraceError("Failed to create grammar for line {0} due to exception:\n{1}", line, ex.ToString());
                 }
             }
 
-            foreach(string phrase in goodbyePhrases) {
-                if (phrase == null || phrase.Trim() == "")
-                    continue;
-                Trace.TraceInformation("Found goodbye phrase: '{0}'", phrase);
-                try {
-                    Grammar g = Phrases.createGrammar(phrase, config, config.IsSubsetMatchingEnabled());
-                    grammarToIndex[g] = -2;
-                } catch (Exception ex) {
-                    Trace.TraceError("Failed to create grammar for exit dialogue phrase {0} due to exception:\n{1}", phrase, ex.ToString());
-                }
+            foreach(Grammar g in config.GetGoodbyeGrammars()) {
+                grammarToIndex[g] = -2;
             }
+
+            cache.PrintStatsToTrace("Dialogue");
         }
 
         public int GetLineIndex(Grammar grammar) {
@@ -61,6 +58,15 @@ namespace DSN {
             return -1;
         }
 
+        public bool IsCompletePhrase(RecognitionResult hypothesis, string text) {
+            return false;
+        }
+
+        // Subset matching accepts any part of a line
+        public bool CanExtend(string text) {
+            return grammarToIndex.Count > 0;
+        }
+
         public List<Grammar> GetGrammars() {
             return new List<Grammar>(this.grammarToIndex.Keys);
         }
@@ -68,7 +74,7 @@ namespace DSN {
         public void PrintToTrace() {
             Trace.TraceInformation("Dialogue List:");
             foreach(Grammar g in grammarToIndex.Keys) {
-                Trace.TraceInformation("Line {0} : {1}", grammarToIndex[g], g.ToString());
+                Log.Verbose("Grammar", "Line {0} : {1}", grammarToIndex[g], g.ToString());
             }
         }
     }
@@ -23,6 +23,15 @@ namespace DSN {
         private FileSystemWatcher configFileWatcher;
         private bool isConfigFileChanged = false;
 
+        // Editors write the file several times when saving, reload once it has been quiet for a while
+        private const int CONFIG_RELOAD_DEBOUNCE_MS = 500;
+        private Timer configReloadTimer;
+        private readonly Object configReloadLock = new Object();
+
+        // Sections that can be applied while the recognition keeps running.
+        // Any other change restarts the whole service.
+        private static readonly HashSet<string> HOT_RELOAD_SECTIONS = new HashSet<string>() { "ConsoleCommands", "Favorites", "Dialogue" };
+
 
         public ExternalInterop(Configuration config, SkyrimInterop skyrimInterop) {
             this.config = config;
@@ -43,6 +52,12 @@ namespace DSN {
             if (configFileWatcher != null) {
                 configFileWatcher.EnableRaisingEvents = false;
             }
+            lock (configReloadLock) {
+                if (configReloadTimer != null) {
+                    configReloadTimer.Dispose();
+                    configReloadTimer = null;
+                }
+            }
         }
 
         private void ListenForBatchDir() {
@@ -105,16 +120,50 @@ namespace DSN {
             {
                 string filename = e.Name.ToLower();
                 if (filename.Equals(configFileName)) {
-                    isConfigFileChanged = true;
-                    Trace.TraceInformation("Config file {0} changed, reload in 3s", filename);
+                    lock (configReloadLock) {
+                        if (configReloadTimer == null) {
+                            configReloadTimer = new Timer(ReloadConfigFile);
+                        }
+                        // Restart the countdown on every change
+                        configReloadTimer.Change(CONFIG_RELOAD_DEBOUNCE_MS, Timeout.Infinite);
+                    }
+                }
+            }
+        }
+
+        private void ReloadConfigFile(object state) {
+            lock (configReloadLock) {
+                if (isConfigFileChanged || !config.IsRunning()) {
+                    return;
+                }
+
+                try {
+                    Stopwatch watch = Stopwatch.StartNew();
+                    Configuration newConfig = new Configuration(config);
+                    List<string> changedSections = newConfig.GetChangedSections(config);
 
-                    // Wait for the configuration file to be saved
-                    Thread.Sleep(3000);
+                    if (changedSections.Count == 0) {
+                        Trace.TraceInformation("Config file reloaded, nothing changed");
+                        return;
+                    }
+
+                    if (changedSections.All((x) => HOT_RELOAD_SECTIONS.Contains(x))) {
+                        skyrimInterop.ApplyConfiguration(newConfig, changedSections);
+                        config = newConfig;
+                        Trace.TraceInformation("Config file reloaded in {0} ms, changed sections: {1}",
+                            watch.ElapsedMilliseconds, string.Join(", ", changedSections));
+                        return;
+                    }
 
-                    config.Stop();
-                    Stop();
-                    skyrimInterop.Stop();
+                    Trace.TraceInformation("Config file changed sections: {0}, restart the service", string.Join(", ", changedSections));
+                } catch (Exception ex) {
+                    Trace.TraceError("Failed to reload the config file, restart the service:\n{0}", ex.ToString());
                 }
+
+                isConfigFileChanged = true;
+                config.Stop();
+                Stop();
+                skyrimInterop.Stop();
             }
         }
 
@@ -5,7 +5,6 @@ using System.Linq;
 using System.Speech.Recognition;
 using System.Text;
 using System.Threading.Tasks;
-using System.Web.Script.Serialization;
 using System.IO;
 
 namespace DSN {
@@ -16,6 +15,27 @@ namespace DSN {
 
         private Configuration config;
         private Dictionary<Grammar, string> commandsByGrammar;
+        // Phrases of the current favorites, replaced as a whole on each update
+        private HashSet<string> itemPhrases = new HashSet<string>();
+
+        // Grammars of the recent favorites, keyed by phrase, command and handedness.
+        // Favorites change a few items at a time and a loaded game usually sends the same list again,
+        // so most grammars can be reused instead of built from scratch.
+        private Dictionary<string, Grammar> grammarCache = new Dictionary<string, Grammar>();
+        private HashSet<string> usedGrammarKeys = new HashSet<string>();
+        private int reusedGrammarCount;
+
+        // Below this many new grammars, building them in parallel costs more than it saves
+        private const int PARALLEL_BUILD_THRESHOLD = 16;
+
+        // A grammar of the list being updated, built in parallel with the others
+        private class GrammarRequest {
+            public string key;
+            public string phrase;
+            public string command;
+            public bool isSingleHanded;
+            public Grammar grammar;
+        }
 
         private bool enabled;
 
@@ -31,6 +51,7 @@ namespace DSN {
         private bool omitHandSuffix = false;
         private string[] equipPhrasePrefix;
         private List<string> knownEquipmentTypes;
+        private KeywordMatcher equipmentTypeMatcher;
 
         private string[] leftHandSuffix;
         private string[] rightHandSuffix;
@@ -63,6 +84,7 @@ namespace DSN {
                 knownEquipmentTypes.Sort((x, y) => y.Length - x.Length);
                 Trace.TraceInformation("Known Equipment Types: \"{0}\"", string.Join("\", \"", knownEquipmentTypes.ToArray()));
             }
+            equipmentTypeMatcher = new KeywordMatcher(knownEquipmentTypes);
 
             leftHandSuffix = Phrases.normalize(config.Get("Favorites", "equipLeftSuffix", "off;left").Split(';'), config);
             rightHandSuffix = Phrases.normalize(config.Get("Favorites", "equipRightSuffix", "main;right").Split(';'), config);
@@ -130,23 +152,54 @@ namespace DSN {
             //       So the code such as `itemName.Split(' ')` will not work for them.
             //       Be aware of this when changing the code below.
             //
-            //    2. knownEquipmentTypes should be sorted in reverse order of string length to avoid prefix masking.
-            //       Consider "axe" and "battleaxe", the former is the prefix of the latter.
-            //       If the order is not correct, the latter will never have a chance to be matched.
-            //       Sorting is currently done in the constructor.
+            //    2. The longest type contained in the name wins, so "battleaxe" is not masked by "axe".
+            //       All types are matched in a single pass over the name, see KeywordMatcher.
             //       Note: Adding leading space alleviates the problem, but some languages don't add spaces between words.
             //
             itemName = Phrases.normalize(itemName, config).ToLower();
+            return equipmentTypeMatcher.FindLongest(itemName);
+        }
+
+        private void AddGrammarRequest(List<GrammarRequest> requests, string phrase, string command, bool isSingleHanded) {
+            GrammarRequest request = new GrammarRequest {
+                key = phrase + "|" + command + "|" + isSingleHanded,
+                phrase = phrase,
+                command = command,
+                isSingleHanded = isSingleHanded
+            };
+            if (grammarCache.TryGetValue(request.key, out request.grammar)) {
+                reusedGrammarCount++;
+            }
+            requests.Add(request);
+        }
 
-            foreach (string type in knownEquipmentTypes) {
-                if (itemName.Contains(type)) {
-                    return type;
+        // Build the missing grammars on the thread pool, then add all of them in the order of the list
+        private void BuildGrammars(Dictionary<Grammar, string> target, List<GrammarRequest> requests) {
+            List<GrammarRequest> missing = requests.Where((x) => x.grammar == null).ToList();
+            Action<GrammarRequest> build = (request) => {
+                try {
+                    request.grammar = BuildGrammar(equipPhrasePrefix, request.phrase, request.isSingleHanded);
+                } catch (Exception ex) {
+                    Trace.TraceError("Failed to build grammar for {0} due to exception:\n{1}", request.phrase, ex.ToString());
                 }
+            };
+            if (missing.Count >= PARALLEL_BUILD_THRESHOLD) {
+                Parallel.ForEach(missing, build);
+            } else {
+                missing.ForEach(build);
+            }
+
+            foreach (GrammarRequest request in requests) {
+                if (request.grammar == null) {
+                    continue;
+                }
+                usedGrammarKeys.Add(request.key);
+                grammarCache[request.key] = request.grammar;
+                target[request.grammar] = request.command;
             }
-            return null;
         }
 
-        public void BuildAndAddGrammar(string[] equipPrefix, string phrase, string command, bool isSingleHanded)
+        public Grammar BuildGrammar(string[] equipPrefix, string phrase, bool isSingleHanded)
         {
             List<string> handsSuffix = new List<string>();
             handsSuffix.AddRange(bothHandsSuffix);
@@ -185,51 +238,59 @@ namespace DSN {
 
             Grammar grammar = new Grammar(grammarBuilder);
             grammar.Name = phrase;
-            commandsByGrammar[grammar] = command;
+            return grammar;
         }
 
-        // Locates and loads item name replacement maps
-        // Returns dynamic map/dictionary or null when the replacement map files cannot be located
-        public dynamic LoadItemNameMap()
-        {
-            string filepath = config.GetItemNameMap();
-            if(filepath != null)
-            {
-                return LoadItemNameMap(filepath);
+        public void Update(string input) {
+            if(!enabled) {
+                return;
             }
-            return null;
-        }
-
-        // Returns a map/dictionary or throws exception when the file cannot be opened/read
-        public dynamic LoadItemNameMap(string path)
-        {
-            var json = System.IO.File.ReadAllText(path);
-            JavaScriptSerializer jsonSerializer = new JavaScriptSerializer();
-            return jsonSerializer.Deserialize<dynamic>(json);
-        }
 
-        public string MaybeReplaceItemName(dynamic nameMap, string itemName)
-        {
-            if (nameMap == null)
-                return itemName;
+            Stopwatch watch = Stopwatch.StartNew();
+            usedGrammarKeys.Clear();
+            reusedGrammarCount = 0;
 
-            try {
-                return nameMap[itemName];
-            } catch {
-                return itemName;
+            commandsByGrammar.Clear();
+            AddItems(commandsByGrammar, input);
+
+            // Keep the cache when the list is cleared (the player is unloaded while loading a game),
+            // the next list is likely to be the same.
+            if (commandsByGrammar.Count > 0) {
+                List<string> unusedKeys = grammarCache.Keys.Where((x) => !usedGrammarKeys.Contains(x)).ToList();
+                foreach (string key in unusedKeys) {
+                    grammarCache.Remove(key);
+                }
             }
+
+            itemPhrases = new HashSet<string>(commandsByGrammar.Keys.Select((x) => x.Name));
+
+            Trace.TraceInformation("Favorites updated: {0} items, {1} grammars, {2} reused, {3} ms",
+                input.Split('|').Count((x) => x.Length > 0), commandsByGrammar.Count, reusedGrammarCount, watch.ElapsedMilliseconds);
+            PrintToTrace();
         }
 
-        public void Update(string input) {
+        // Build the grammars of the favorites saved in the last session, before any game is loaded.
+        // They are reused by the next Update if the loaded game has the same favorites.
+        public void Prepare(string input) {
             if(!enabled) {
                 return;
             }
 
+            Stopwatch watch = Stopwatch.StartNew();
+            Dictionary<Grammar, string> preparedGrammars = new Dictionary<Grammar, string>();
+            AddItems(preparedGrammars, input);
+
+            Trace.TraceInformation("Favorites snapshot prepared: {0} grammars, {1} ms",
+                preparedGrammars.Count, watch.ElapsedMilliseconds);
+        }
+
+        private void AddItems(Dictionary<Grammar, string> target, string input) {
             var firstEquipmentOfType = new Dictionary<string, string> { };
 
-            dynamic itemNameMap = LoadItemNameMap();
+            ItemNameMap itemNameMap = config.GetItemNameMap();
+            itemNameMap.Refresh();
 
-            commandsByGrammar.Clear();
+            List<GrammarRequest> requests = new List<GrammarRequest>();
             string[] itemTokens = input.Split('|');
             foreach(string itemStr in itemTokens) {
                 try
@@ -245,31 +306,31 @@ namespace DSN {
                     bool isSingleHanded = int.Parse(tokens[3]) > 0;
                     int typeId = int.Parse(tokens[4]);
 
-                    itemName = MaybeReplaceItemName(itemNameMap, itemName);
+                    itemName = itemNameMap.Replace(itemName);
                     string command = formId + ";" + itemId + ";" + typeId + ";";
 
-                    BuildAndAddGrammar(equipPhrasePrefix, Phrases.normalize(itemName, config), command, isSingleHanded);
+                    AddGrammarRequest(requests, Phrases.normalize(itemName, config), command, isSingleHanded);
 
                     // Are we looking at an equipment of some sort?
                     // Record the first item of a specific weapon type
                     string equipmentType = ProbableEquipmentType(itemName);
                     if(equipmentType != null && !firstEquipmentOfType.ContainsKey(equipmentType))
                     {
-                        Trace.TraceInformation("ProbableEquipmentType: {0} -> {1}", itemName, equipmentType);
-                        BuildAndAddGrammar(equipPhrasePrefix, Phrases.normalize(equipmentType, config), command, isSingleHanded);
+                        Log.Verbose("Grammar", "ProbableEquipmentType: {0} -> {1}", itemName, equipmentType);
+                        AddGrammarRequest(requests, Phrases.normalize(equipmentType, config), command, isSingleHanded);
                     }
                 } catch(Exception ex) {
                     Trace.TraceError("Failed to parse {0} due to exception:\n{1}", itemStr, ex.ToString());
                 }
             }
 
-            PrintToTrace();
+            BuildGrammars(target, requests);
         }
 
         public void PrintToTrace() {
             Trace.TraceInformation("Favorites List Phrases:");
             foreach (KeyValuePair<Grammar, string> entry in commandsByGrammar) {
-                Trace.TraceInformation("Phrase '{0}' mapped to equip command '{1}'", entry.Key.Name, entry.Value);
+                Log.Verbose("Grammar", "Phrase '{0}' mapped to equip command '{1}'", entry.Key.Name, entry.Value);
             }
         }
 
@@ -318,6 +379,32 @@ namespace DSN {
             return null;
         }
 
+        // The hand suffix is optional, acting early could equip the wrong hand
+        public bool IsCompletePhrase(RecognitionResult hypothesis, string text) {
+            return false;
+        }
+
+        // The hand and equip words before an item are optional, so a text that starts with one of them,
+        // or is the beginning of one, is assumed to be extended.
+        public bool CanExtend(string text) {
+            HashSet<string> phrases = itemPhrases;
+            if (phrases.Count == 0) {
+                return false;
+            }
+
+            IEnumerable<string> handWords = bothHandsSuffix.Concat(rightHandSuffix).Concat(leftHandSuffix);
+            IEnumerable<string> leadingWords = equipPhrasePrefix;
+            if (useEquipHandPrefix || useEquipHandInfix) {
+                leadingWords = leadingWords.Concat(handWords);
+            }
+            if (leadingWords.Any((x) => x.StartsWith(text, StringComparison.OrdinalIgnoreCase) || text.StartsWith(x, StringComparison.OrdinalIgnoreCase))) {
+                return true;
+            }
+
+            bool hasHandSuffix = useEquipHandSuffix && handWords.Any();
+            return phrases.Any((x) => Phrases.canExtend(x, text, config) || (hasHandSuffix && string.Equals(x, text, StringComparison.OrdinalIgnoreCase)));
+        }
+
         public List<Grammar> GetGrammars() {
             return new List<Grammar>(commandsByGrammar.Keys);
         }
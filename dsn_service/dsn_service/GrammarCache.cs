@@ -0,0 +1,70 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Speech.Recognition;
+
+namespace DSN {
+    // Bounded LRU cache of the grammars of dialogue lines.
+    // The same topics are offered again and again, building their grammars each time is wasted work.
+    class GrammarCache {
+        private class Entry {
+            public string key;
+            public Grammar grammar;
+        }
+
+        private readonly int capacity;
+        private readonly Dictionary<string, LinkedListNode<Entry>> entries = new Dictionary<string, LinkedListNode<Entry>>();
+        // Most recently used first
+        private readonly LinkedList<Entry> usage = new LinkedList<Entry>();
+
+        public long Hits { get; private set; }
+        public long Misses { get; private set; }
+        public long Evictions { get; private set; }
+
+        public GrammarCache(int capacity) {
+            this.capacity = Math.Max(capacity, 0);
+        }
+
+        public double HitRate {
+            get {
+                long total = Hits + Misses;
+                return total == 0 ? 0 : (double)Hits / total;
+            }
+        }
+
+        // phrase should be normalized, grammars built with and without subset matching are cached separately
+        public Grammar GetOrCreate(string phrase, Configuration config, bool isSubsetMatchingEnabled) {
+            string key = (isSubsetMatchingEnabled ? config.getConfiguredMatchingMode().ToString() : "") + "|" + phrase;
+
+            LinkedListNode<Entry> node;
+            if (entries.TryGetValue(key, out node)) {
+                Hits++;
+                usage.Remove(node);
+                usage.AddFirst(node);
+                return node.Value.grammar;
+            }
+
+            Misses++;
+            Grammar grammar = Phrases.createGrammar(phrase, config, isSubsetMatchingEnabled);
+            if (capacity == 0) {
+                return grammar;
+            }
+
+            if (entries.Count >= capacity) {
+                LinkedListNode<Entry> last = usage.Last;
+                usage.RemoveLast();
+                entries.Remove(last.Value.key);
+                Evictions++;
+            }
+
+            node = usage.AddFirst(new Entry { key = key, grammar = grammar });
+            entries[key] = node;
+            return grammar;
+        }
+
+        public void PrintStatsToTrace(string name) {
+            Trace.TraceInformation("{0} grammar cache: {1} hits, {2} misses, {3:P1} hit rate, {4} evictions, {5}/{6} entries",
+                name, Hits, Misses, HitRate, Evictions, entries.Count, capacity);
+        }
+    }
+}
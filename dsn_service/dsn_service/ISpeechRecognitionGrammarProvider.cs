@@ -8,5 +8,12 @@ using System.Threading.Tasks;
 namespace DSN {
     interface ISpeechRecognitionGrammarProvider {
         List<Grammar> GetGrammars();
+
+        // Whether a hypothesis is a whole phrase of the provider. text is the normalized hypothesis.
+        // It can be acted on before the recognition is final if no enabled grammar can extend it.
+        bool IsCompletePhrase(RecognitionResult hypothesis, string text);
+
+        // Whether a phrase of the provider's grammars may be longer than the normalized text and start with it
+        bool CanExtend(string text);
     }
 }
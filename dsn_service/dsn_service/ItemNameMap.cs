@@ -0,0 +1,78 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Web.Script.Serialization;
+
+namespace DSN {
+    // Item name replacement map (item-name-map.json), loaded once and reloaded only when the file changes.
+    // Favorites are sent many times per session, the map is usually much larger than the favorites list.
+    class ItemNameMap {
+        private readonly string path;
+        private Dictionary<string, string> names = new Dictionary<string, string>();
+        private DateTime lastWriteTime = DateTime.MinValue;
+        private long lastLength = -1;
+
+        // path: null when no map file was found, every name is kept as is
+        public ItemNameMap(string path) {
+            this.path = path;
+        }
+
+        // Looks up the name in the map as of the last Refresh()
+        public string Replace(string itemName) {
+            string replacement;
+            if (names.TryGetValue(itemName, out replacement) && replacement != null) {
+                return replacement;
+            }
+            return itemName;
+        }
+
+        // Reloads the map if the file changed. Call once per favorites list, not per item.
+        public void Refresh() {
+            if (path == null) {
+                return;
+            }
+
+            try {
+                FileInfo file = new FileInfo(path);
+                if (!file.Exists) {
+                    if (lastLength != -1) {
+                        Trace.TraceInformation("Item name map {0} removed", path);
+                        names = new Dictionary<string, string>();
+                        lastWriteTime = DateTime.MinValue;
+                        lastLength = -1;
+                    }
+                    return;
+                }
+                if (file.LastWriteTimeUtc == lastWriteTime && file.Length == lastLength) {
+                    return;
+                }
+
+                Stopwatch watch = Stopwatch.StartNew();
+                names = Load(path);
+                lastWriteTime = file.LastWriteTimeUtc;
+                lastLength = file.Length;
+                Trace.TraceInformation("Item name map {0} loaded: {1} names, {2} ms", path, names.Count, watch.ElapsedMilliseconds);
+            } catch (Exception ex) {
+                // Keep the previous map, the file may be being written
+                Trace.TraceError("Failed to load item name map {0}:\n{1}", path, ex.ToString());
+            }
+        }
+
+        private static Dictionary<string, string> Load(string path) {
+            string json = File.ReadAllText(path);
+            JavaScriptSerializer jsonSerializer = new JavaScriptSerializer();
+            jsonSerializer.MaxJsonLength = int.MaxValue;
+
+            Dictionary<string, object> map = jsonSerializer.Deserialize<Dictionary<string, object>>(json);
+            Dictionary<string, string> names = new Dictionary<string, string>(map.Count);
+            foreach (KeyValuePair<string, object> pair in map) {
+                string name = pair.Value as string;
+                if (name != null) {
+                    names[pair.Key] = name;
+                }
+            }
+            return names;
+        }
+    }
+}
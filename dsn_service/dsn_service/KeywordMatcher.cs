@@ -0,0 +1,90 @@
+﻿using System.Collections.Generic;
+
+namespace DSN {
+    // Finds the longest keyword contained in a text in a single pass (Aho-Corasick automaton).
+    // Matches anywhere in the text, so it also works for languages without spaces between words.
+    class KeywordMatcher {
+        private class Node {
+            public Dictionary<char, Node> next = new Dictionary<char, Node>();
+            public Node fail;
+            // Longest keyword ending at this node, following the fail links. -1 when none.
+            public int keyword = -1;
+        }
+
+        private readonly List<string> keywords;
+        private readonly Node root = new Node();
+
+        // On ties in length, the keyword first in the list wins
+        public KeywordMatcher(List<string> keywords) {
+            this.keywords = keywords;
+
+            for (int i = 0; i < keywords.Count; ++i) {
+                if (keywords[i].Length == 0) {
+                    continue;
+                }
+                Node node = root;
+                foreach (char c in keywords[i]) {
+                    Node child;
+                    if (!node.next.TryGetValue(c, out child)) {
+                        child = new Node();
+                        node.next.Add(c, child);
+                    }
+                    node = child;
+                }
+                if (node.keyword < 0) {
+                    node.keyword = i;
+                }
+            }
+
+            // Breadth first, so the fail node of a node is complete before the node itself
+            Queue<Node> queue = new Queue<Node>();
+            root.fail = root;
+            foreach (Node child in root.next.Values) {
+                child.fail = root;
+                queue.Enqueue(child);
+            }
+            while (queue.Count > 0) {
+                Node node = queue.Dequeue();
+                node.keyword = Better(node.keyword, node.fail.keyword);
+
+                foreach (KeyValuePair<char, Node> pair in node.next) {
+                    Node fail = node.fail;
+                    Node target;
+                    while (!fail.next.TryGetValue(pair.Key, out target) && fail != root) {
+                        fail = fail.fail;
+                    }
+                    pair.Value.fail = (target != null && target != pair.Value) ? target : root;
+                    queue.Enqueue(pair.Value);
+                }
+            }
+        }
+
+        // Returns the longest keyword contained in text, or null
+        public string FindLongest(string text) {
+            int best = -1;
+            Node node = root;
+            foreach (char c in text) {
+                Node next;
+                while (!node.next.TryGetValue(c, out next) && node != root) {
+                    node = node.fail;
+                }
+                node = next ?? root;
+                best = Better(best, node.keyword);
+            }
+            return best < 0 ? null : keywords[best];
+        }
+
+        private int Better(int a, int b) {
+            if (a < 0) {
+                return b;
+            }
+            if (b < 0) {
+                return a;
+            }
+            if (keywords[a].Length != keywords[b].Length) {
+                return keywords[a].Length > keywords[b].Length ? a : b;
+            }
+            return a < b ? a : b;
+        }
+    }
+}
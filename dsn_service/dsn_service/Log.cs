@@ -7,6 +7,8 @@ using System.Threading.Tasks;
 
 namespace DSN {
     class Log {
+        private static AsyncLogListener listener = null;
+
         public static void Initialize() {
             try {
                 // remove the suffix "/"
@@ -19,15 +21,64 @@ namespace DSN {
             string logFilePath = Configuration.MY_DOCUMENT_DSN_DIR + Configuration.ERROR_LOG_FILE;
             try {
                 // The compiler constant TRACE needs to be defined, otherwise logs will not be output to the file.
-                var listener = new TextWriterTraceListener(logFilePath);
-                listener.TraceOutputOptions = TraceOptions.DateTime;
-                Trace.AutoFlush = true;
+                listener = new AsyncLogListener(logFilePath);
+                // The listener is thread safe, callers don't need to wait for each other.
+                // The default listener (OutputDebugString) is removed, it is synchronous.
+                Trace.UseGlobalLock = false;
+                Trace.Listeners.Remove("Default");
                 Trace.Listeners.Add(listener);
+
+                // Without these, the messages still queued are lost when the service crashes or is killed
+                AppDomain.CurrentDomain.UnhandledException += OnUnhandledException;
+                AppDomain.CurrentDomain.ProcessExit += OnProcessExit;
             }
             catch(Exception ex) {
                 Console.Error.WriteLine("Failed to create log file at " + logFilePath + ": {0}", ex.ToString());
             }
     
         }
+
+        // Apply the [Log] section of the configuration
+        public static void Configure(Configuration config) {
+            if (listener == null) {
+                return;
+            }
+
+            TraceEventType level;
+            if (!Enum.TryParse(config.Get("Log", "level", "Verbose"), true, out level)) {
+                level = TraceEventType.Verbose;
+            }
+            string[] disabledCategories = config.Get("Log", "disabledCategories", "")
+                .Split(';').Select((x) => x.Trim()).Where((x) => x.Length > 0).ToArray();
+            long maxFileSize = long.Parse(config.Get("Log", "maxFileSizeMB", "10")) * 1024 * 1024;
+            int maxFiles = int.Parse(config.Get("Log", "maxFiles", "3"));
+
+            listener.Configure(level, disabledCategories, maxFileSize, maxFiles);
+        }
+
+        // Detailed message of a category that can be disabled in the configuration.
+        // The message is not formatted when it is disabled.
+        public static void Verbose(string category, string format, params object[] args) {
+            if (listener != null && !listener.IsEnabled(TraceEventType.Verbose, category)) {
+                return;
+            }
+            Trace.WriteLine(args.Length == 0 ? format : string.Format(format, args), category);
+        }
+
+        private static void OnUnhandledException(object sender, UnhandledExceptionEventArgs e) {
+            // Errors are written synchronously, with the messages queued before them
+            Trace.TraceError("Unhandled exception:\n{0}", e.ExceptionObject);
+        }
+
+        private static void OnProcessExit(object sender, EventArgs e) {
+            listener.Flush();
+        }
+
+        // Write the queued messages before the service exits
+        public static void Shutdown() {
+            if (listener != null) {
+                listener.Shutdown(TimeSpan.FromSeconds(2));
+            }
+        }
     }
 }
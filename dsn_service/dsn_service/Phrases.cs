@@ -9,6 +9,8 @@ using System.Threading.Tasks;
 
 namespace DSN {
     class Phrases {
+        private const int MAX_EXPANDED_OPTIONAL_PARTS = 4;
+
         public static string normalize(string phrase, Configuration config) {
             var regex = config.GetNormalizeExpression();
             var repl = config.GetNormalizeReplacement();
@@ -64,6 +66,41 @@ namespace DSN {
             }
         }
 
+        // Whether a form of the phrase, with or without its optional parts, is longer than the text and starts with it.
+        // Both are normalized. Phrases with many optional parts are assumed to extend any text.
+        public static bool canExtend(string phrase, string text, Configuration config) {
+            var optionalExpression = config.GetOptionalExpression();
+            if (optionalExpression == null) {
+                return phrase.Length > text.Length && phrase.StartsWith(text, StringComparison.OrdinalIgnoreCase);
+            }
+
+            var phraseParts = optionalExpression.Replace(phrase, "\0" + config.GetOptionalReplacement() + "\0").Split('\0');
+            int optionalCount = phraseParts.Length / 2;
+            if (optionalCount > MAX_EXPANDED_OPTIONAL_PARTS) {
+                return true;
+            }
+
+            // Each bit of the mask includes one optional part
+            for (int mask = 0; mask < (1 << optionalCount); mask++) {
+                StringBuilder form = new StringBuilder();
+                for (int i = 0; i < phraseParts.Length; i++) {
+                    string part = phraseParts[i].Trim();
+                    if (part.Length == 0 || (i % 2 == 1 && (mask & (1 << (i / 2))) == 0)) {
+                        continue;
+                    }
+                    if (form.Length > 0) {
+                        form.Append(' ');
+                    }
+                    form.Append(part);
+                }
+                string formStr = form.ToString();
+                if (formStr.Length > text.Length && formStr.StartsWith(text, StringComparison.OrdinalIgnoreCase)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
         public static Grammar createGrammar(string phrase, Configuration config, bool isSubsetMatchingEnabled = false) {
             GrammarBuilder builder = new GrammarBuilder();
             appendPhrase(builder, phrase, config, isSubsetMatchingEnabled);
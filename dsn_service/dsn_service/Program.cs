@@ -38,6 +38,7 @@ namespace DSN {
                 while (reloadConfigFile)
                 {
                     Configuration config = new Configuration();
+                    Log.Configure(config);
                     SkyrimInterop skyrimInterop = new SkyrimInterop(config, consoleInput);
                     ExternalInterop externalInterop = new ExternalInterop(config, skyrimInterop);
 
@@ -60,6 +61,8 @@ namespace DSN {
 
             } catch (Exception ex) {
                 Trace.TraceError(ex.ToString());
+            } finally {
+                Log.Shutdown();
             }
         }
     }
@@ -65,6 +65,43 @@ namespace DSN {
             recognizer.Stop();
         }
 
+        // Apply a reloaded configuration whose changes don't need a restart. Recognition keeps running.
+        public void ApplyConfiguration(Configuration newConfig, List<string> changedSections) {
+            lock (dialogueLock) {
+                config = newConfig;
+                dialogueEnabled = (config.Get("Dialogue", "enabled", "1") == "1");
+
+                if (changedSections.Contains("Favorites")) {
+                    favoritesList = new FavoritesList(config);
+                    if (consoleInput.currentFavoritesList != null) {
+                        favoritesList.Update(GetArguments(consoleInput.currentFavoritesList));
+                    }
+                }
+
+                if (consoleInput.currentDialogue == null) {
+                    recognizer.StartSpeechRecognition(false, config.GetConsoleCommandList(), favoritesList);
+                    return;
+                }
+
+                recognizer.UpdateGrammars(false, config.GetConsoleCommandList(), favoritesList);
+                if (changedSections.Contains("Dialogue")) {
+                    if (dialogueEnabled) {
+                        currentDialogue = DialogueList.Parse(GetArguments(consoleInput.currentDialogue), config);
+                        recognizer.StartSpeechRecognition(true, currentDialogue);
+                    } else {
+                        currentDialogue = null;
+                        recognizer.StopRecognition();
+                    }
+                }
+            }
+        }
+
+        // "COMMAND|arg1|arg2" -> "arg1|arg2"
+        private static string GetArguments(string input) {
+            int separator = input.IndexOf('|');
+            return separator < 0 ? "" : input.Substring(separator + 1);
+        }
+
         public void SubmitCommand(string command) {
             commandQueue.Add(sanitize(command));
         }
@@ -84,7 +121,7 @@ namespace DSN {
                     break;
                 }
 
-                Trace.TraceInformation("Sending command: {0}", command);
+                Log.Verbose("Interop", "Sending command: {0}", command);
                 Console.Write(command+"\n");
             }
         }
@@ -103,7 +140,7 @@ namespace DSN {
                         break;
                     }
 
-                    Trace.TraceInformation("Received command: {0}", input);
+                    Log.Verbose("Interop", "Received command: {0}", input);
                     lock (dialogueLock) {
                         string[] tokens = input.Split('|');
                         string command = tokens[0];
@@ -127,7 +164,13 @@ namespace DSN {
                             favoritesList.Update(string.Join("|", tokens, 1, tokens.Length - 1));
                             if(consoleInput.currentDialogue == null) {
                                 recognizer.StartSpeechRecognition(false, config.GetConsoleCommandList(), favoritesList);
+                            } else {
+                                // Keep the dialogue, the command engine is ready when it ends
+                                recognizer.UpdateGrammars(false, config.GetConsoleCommandList(), favoritesList);
                             }
+                        } else if (command.Equals("FAVORITES_SNAPSHOT")) {
+                            // Favorites of the last session, prepare their grammars while the game is loading
+                            favoritesList.Prepare(string.Join("|", tokens, 1, tokens.Length - 1));
                         }
                     }
                 }
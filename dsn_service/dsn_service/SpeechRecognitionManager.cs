@@ -1,4 +1,4 @@
-using System;
+﻿using System;
 using System.Collections.Generic;
 using System.Linq;
 using System.Speech.Recognition;
@@ -20,15 +20,75 @@ namespace DSN {
         public event DialogueLineRecognitionHandler OnDialogueLineRecognized;
 
         private bool isPaused = false;
-        private List<Grammar> pausePhrases = new List<Grammar>();
-        private List<Grammar> resumePhrases = new List<Grammar>();
         private readonly string pauseAudioFile;
         private readonly string resumeAudioFile;
 
         private long recognitionStatus = STATUS_WAITING_DEVICE; // Need thread safety.
         private Thread waitingDeviceThread;
 
-        private readonly SpeechRecognitionEngine DSN;
+        // A recognition engine with its own grammars.
+        // Grammars can only be loaded into one engine, so each engine has its own pause/resume phrases.
+        private class RecognitionEngine {
+            public string name;
+            public SpeechRecognitionEngine engine;
+            public ISpeechRecognitionGrammarProvider[] grammarProviders;
+            public List<Grammar> pausePhrases = new List<Grammar>();
+            public List<Grammar> resumePhrases = new List<Grammar>();
+            // Normalized texts of the pause and resume phrases
+            public List<string> pausePhraseStrings = new List<string>();
+            public List<string> resumePhraseStrings = new List<string>();
+            // Grammars loaded into the engine, enabled or not.
+            // Only the difference is loaded or unloaded when the grammars change.
+            public HashSet<Grammar> loadedGrammars = new HashSet<Grammar>();
+            public bool isRecognizing = false;
+            // Grammars to switch to once the running engine reaches its next recognizer update, null if none
+            public HashSet<Grammar> pendingGrammars = null;
+            public HashSet<Grammar> pendingKeptGrammars = null;
+            public readonly Stopwatch pendingWatch = new Stopwatch();
+
+            // Timeout profile of the mode. The ambiguous end silence timeout adapts to the pauses of the user when enabled.
+            public TimeSpan endSilenceTimeout;
+            public TimeSpan endSilenceTimeoutAmbiguous;
+            // The configured ambiguous timeout, it only adapts upward from there
+            public TimeSpan minEndSilenceTimeoutAmbiguous;
+            public TimeSpan maxEndSilenceTimeoutAmbiguous;
+            public TimeSpan babbleTimeout;
+            // Grammar classes recognized by the engine, their timings tune its ambiguous end silence timeout
+            public string[] timingClasses;
+            public int samplesSinceAdapted = 0;
+            // The gated stream read by the engine, null when it reads the device directly
+            public VoiceActivityGate.GatedAudioStream inputStream = null;
+        }
+
+        // Adapt after this many new utterances, once there are enough of them
+        private const int ADAPT_INTERVAL = 10;
+        private const int ADAPT_MIN_SAMPLES = 20;
+        // Added to the 95th percentile of the longest pause within an utterance
+        private const double ADAPT_MARGIN_MS = 50;
+        private const string TIMING_CLASS_COMMANDS = "commands";
+        private const string TIMING_CLASS_FAVORITES = "favorites";
+        private const string TIMING_CLASS_DIALOGUE = "dialogue";
+        // Keyed by grammar class, shared by the engines so each class keeps its own distribution
+        private readonly Dictionary<string, UtteranceTimings> timingsByClass = new Dictionary<string, UtteranceTimings>();
+        private readonly bool adaptiveTimeouts = false;
+
+        // Opt-in: feed the engines only the audio around speech instead of the whole recording
+        private readonly bool useVoiceActivityGate = false;
+        private readonly double voiceGateThreshold;
+        private readonly int voiceGatePreRoll;
+        private readonly int voiceGateHangover;
+        private VoiceActivityGate voiceActivityGate = null;
+
+        // CPU time used by the service, logged periodically to compare with and without the gate
+        private const int CPU_USAGE_LOG_INTERVAL_MS = 5 * 60 * 1000;
+        private readonly Timer cpuUsageTimer;
+        private readonly Stopwatch cpuUsageWatch = Stopwatch.StartNew();
+        private TimeSpan lastProcessorTime = Process.GetCurrentProcess().TotalProcessorTime;
+
+        // Both engines keep running, switching modes enables the grammars of one and disables the other's.
+        // Restarting a single engine for every dialogue loses the speech that starts in the gap.
+        private readonly RecognitionEngine commandEngine;
+        private readonly RecognitionEngine dialogueEngine;
         private readonly Object dsnLock = new Object();
 
         // Dialogue can be more generous in the min confidence because
@@ -37,8 +97,17 @@ namespace DSN {
         private readonly float commandMinimumConfidence = 0.7f;
         private readonly bool logAudioSignalIssues = false;
 
+        // Opt-in: dispatch a command as soon as a hypothesis is a complete and unambiguous phrase,
+        // instead of waiting for the end of the utterance.
+        private readonly bool speculativeCommands = false;
+        private readonly float speculativeMinimumConfidence = 0.9f;
+        // Dispatched from the hypothesis of the current utterance, its final recognition must not dispatch it again
+        private Grammar speculativeGrammar = null;
+        private readonly Stopwatch speculativeWatch = new Stopwatch();
+        private long speculativeCount = 0;
+        private long speculativeSavedMilliseconds = 0;
+
         private bool isDialogueMode = false;
-        private ISpeechRecognitionGrammarProvider[] grammarProviders;
 
         private string currentDeviceId = null;
         private readonly MMDeviceEnumerator deviceEnum = new MMDeviceEnumerator();
@@ -50,47 +119,171 @@ namespace DSN {
             dialogueMinimumConfidence = float.Parse(config.Get("SpeechRecognition", "dialogueMinConfidence", "0.5"), CultureInfo.InvariantCulture);
             commandMinimumConfidence = float.Parse(config.Get("SpeechRecognition", "commandMinConfidence", "0.7"), CultureInfo.InvariantCulture);
             logAudioSignalIssues = config.Get("SpeechRecognition", "bLogAudioSignalIssues", "0") == "1";
+            speculativeCommands = config.Get("SpeechRecognition", "bSpeculativeCommands", "0") == "1";
+            speculativeMinimumConfidence = float.Parse(config.Get("SpeechRecognition", "speculativeMinConfidence", "0.9"), CultureInfo.InvariantCulture);
+            adaptiveTimeouts = config.Get("SpeechRecognition", "bAdaptiveTimeouts", "0") == "1";
+            useVoiceActivityGate = config.Get("SpeechRecognition", "bVoiceActivityGate", "0") == "1";
+            voiceGateThreshold = double.Parse(config.Get("SpeechRecognition", "voiceGateThreshold", "0.01"), CultureInfo.InvariantCulture);
+            voiceGatePreRoll = int.Parse(config.Get("SpeechRecognition", "voiceGatePreRoll", "300"));
+            voiceGateHangover = int.Parse(config.Get("SpeechRecognition", "voiceGateHangover", "1500"));
 
             Trace.TraceInformation("Locale: {0}\nDialogueConfidence: {1}\nCommandConfidence: {2}", config.GetLocale(), dialogueMinimumConfidence, commandMinimumConfidence);
+            if (speculativeCommands) {
+                Trace.TraceInformation("Speculative commands enabled, confidence: {0}", speculativeMinimumConfidence);
+            }
 
             pauseAudioFile = config.Get("SpeechRecognition", "pauseAudioFile", DEFAULT_PAUSE_AUDIO_FILE).Trim();
             resumeAudioFile = config.Get("SpeechRecognition", "resumeAudioFile", DEFAULT_RESUME_AUDIO_FILE).Trim();
 
-            List<string> pausePhraseStrings = config.GetPausePhrases();
-            List<string> resumePhraseStrings = config.GetResumePhrases();
-            foreach (string phrase in pausePhraseStrings) {
-                if (phrase == null || phrase.Trim() == "")
-                    continue;
-                Trace.TraceInformation("Found pause phrase: '{0}'", phrase);
-                try {
-                    Grammar g = Phrases.createGrammar(Phrases.normalize(phrase, config), config);
-                    pausePhrases.Add(g);
-                } catch (Exception ex) {
-                    Trace.TraceError("Failed to create grammar for pause phrase {0} due to exception:\n{1}", phrase, ex.ToString());
-                }
+            List<string> pausePhraseStrings = GetPhrases(config.GetPausePhrases(), "pause");
+            List<string> resumePhraseStrings = GetPhrases(config.GetResumePhrases(), "resume");
+
+            commandEngine = CreateEngine("command", pausePhraseStrings, resumePhraseStrings);
+            dialogueEngine = CreateEngine("dialogue", pausePhraseStrings, resumePhraseStrings);
+            this.deviceEnum.RegisterEndpointNotificationCallback(this);
+            cpuUsageTimer = new Timer(LogCpuUsage, null, CPU_USAGE_LOG_INTERVAL_MS, CPU_USAGE_LOG_INTERVAL_MS);
+
+            WaitRecordingDeviceNonBlocking();
+        }
+
+        private void LogCpuUsage(object state) {
+            TimeSpan processorTime = Process.GetCurrentProcess().TotalProcessorTime;
+            double elapsedMs = cpuUsageWatch.Elapsed.TotalMilliseconds;
+            double usage = (processorTime - lastProcessorTime).TotalMilliseconds / elapsedMs / Environment.ProcessorCount;
+            lastProcessorTime = processorTime;
+            cpuUsageWatch.Restart();
+
+            VoiceActivityGate gate = voiceActivityGate;
+            if (gate != null) {
+                Trace.TraceInformation("CPU usage {0:P1} over the last {1:0} s, voice gate open {2:P1} of the time", usage, elapsedMs / 1000, gate.TakeOpenRatio());
+            } else {
+                Trace.TraceInformation("CPU usage {0:P1} over the last {1:0} s", usage, elapsedMs / 1000);
             }
-            foreach (string phrase in resumePhraseStrings) {
+        }
+
+        private static List<string> GetPhrases(List<string> phrases, string kind) {
+            List<string> result = new List<string>();
+            foreach (string phrase in phrases) {
                 if (phrase == null || phrase.Trim() == "")
                     continue;
-                Trace.TraceInformation("Found resume phrase: '{0}'", phrase);
+                Trace.TraceInformation("Found {0} phrase: '{1}'", kind, phrase);
+                result.Add(phrase);
+            }
+            return result;
+        }
+
+        private List<Grammar> CreatePhraseGrammars(List<string> phrases, string kind) {
+            List<Grammar> grammars = new List<Grammar>();
+            foreach (string phrase in phrases) {
                 try {
                     Grammar g = Phrases.createGrammar(Phrases.normalize(phrase, config), config);
-                    resumePhrases.Add(g);
+                    grammars.Add(g);
                 } catch (Exception ex) {
-                    Trace.TraceError("Failed to create grammar for resume phrase {0} due to exception:\n{1}", phrase, ex.ToString());
+                    Trace.TraceError("Failed to create grammar for {0} phrase {1} due to exception:\n{2}", kind, phrase, ex.ToString());
                 }
             }
+            return grammars;
+        }
 
-            this.DSN = new SpeechRecognitionEngine(config.GetLocale());
-            this.DSN.UpdateRecognizerSetting("CFGConfidenceRejectionThreshold", 10); // Range is 0-100
-            this.DSN.EndSilenceTimeoutAmbiguous = TimeSpan.FromMilliseconds(250);
-            this.DSN.AudioStateChanged += DSN_AudioStateChanged;
-            this.DSN.AudioSignalProblemOccurred += DSN_AudioSignalProblemOccurred;
-            this.DSN.SpeechRecognized += DSN_SpeechRecognized;
-            this.DSN.SpeechRecognitionRejected += DSN_SpeechRecognitionRejected;
-            this.deviceEnum.RegisterEndpointNotificationCallback(this);
+        private RecognitionEngine CreateEngine(string name, List<string> pausePhraseStrings, List<string> resumePhraseStrings) {
+            RecognitionEngine e = new RecognitionEngine();
+            e.name = name;
+            e.pausePhrases = CreatePhraseGrammars(pausePhraseStrings, "pause");
+            e.resumePhrases = CreatePhraseGrammars(resumePhraseStrings, "resume");
+            e.pausePhraseStrings = pausePhraseStrings.Select((x) => Phrases.normalize(x, config)).ToList();
+            e.resumePhraseStrings = resumePhraseStrings.Select((x) => Phrases.normalize(x, config)).ToList();
+
+            e.engine = new SpeechRecognitionEngine(config.GetLocale());
+            e.engine.UpdateRecognizerSetting("CFGConfidenceRejectionThreshold", 10); // Range is 0-100
+
+            // Short commands want a short end silence, long dialogue lines have longer pauses between words
+            e.endSilenceTimeout = GetMilliseconds(name + "EndSilenceTimeout", "150");
+            e.endSilenceTimeoutAmbiguous = GetMilliseconds(name + "EndSilenceTimeoutAmbiguous", "250");
+            e.minEndSilenceTimeoutAmbiguous = e.endSilenceTimeoutAmbiguous;
+            e.maxEndSilenceTimeoutAmbiguous = GetMilliseconds(name + "MaxEndSilenceTimeoutAmbiguous", name == "dialogue" ? "1000" : "500");
+            e.babbleTimeout = GetMilliseconds(name + "BabbleTimeout", "0");
+            e.timingClasses = name == "dialogue" ? new string[] { TIMING_CLASS_DIALOGUE } : new string[] { TIMING_CLASS_COMMANDS, TIMING_CLASS_FAVORITES };
+            ApplyTimeouts(e);
+
+            e.engine.AudioStateChanged += DSN_AudioStateChanged;
+            e.engine.AudioSignalProblemOccurred += DSN_AudioSignalProblemOccurred;
+            e.engine.SpeechRecognized += DSN_SpeechRecognized;
+            e.engine.SpeechRecognitionRejected += DSN_SpeechRecognitionRejected;
+            e.engine.RecognizerUpdateReached += DSN_RecognizerUpdateReached;
+            if (speculativeCommands) {
+                e.engine.SpeechHypothesized += DSN_SpeechHypothesized;
+            }
+            return e;
+        }
 
-            WaitRecordingDeviceNonBlocking();
+        private TimeSpan GetMilliseconds(string key, string defaultValue) {
+            return TimeSpan.FromMilliseconds(int.Parse(config.Get("SpeechRecognition", key, defaultValue)));
+        }
+
+        private void ApplyTimeouts(RecognitionEngine e) {
+            try {
+                e.engine.EndSilenceTimeout = e.endSilenceTimeout;
+                e.engine.EndSilenceTimeoutAmbiguous = e.endSilenceTimeoutAmbiguous;
+                e.engine.BabbleTimeout = e.babbleTimeout;
+                Trace.TraceInformation("{0} timeouts: end silence {1} ms, ambiguous end silence {2} ms, babble {3} ms", e.name,
+                    e.endSilenceTimeout.TotalMilliseconds, e.endSilenceTimeoutAmbiguous.TotalMilliseconds, e.babbleTimeout.TotalMilliseconds);
+            } catch (Exception ex) {
+                Trace.TraceError("Failed to set the {0} timeouts:\n{1}", e.name, ex.ToString());
+            }
+        }
+
+        // Record the timings of an utterance and adapt the ambiguous end silence timeout of its engine.
+        // The engine waits that long when the phrase could go on, it must be longer than the pauses between words
+        // or the phrase is cut, and as short as possible otherwise.
+        // A pause longer than the timeout ends the utterance, so it is never measured and the percentile can only
+        // drift down: rejected and low confidence utterances are recorded too, and the timeout never goes below
+        // the configured one.
+        // Each class is measured on its own: many short commands would otherwise hide the longer pauses of favorites.
+        // The command engine recognizes commands and favorites with one timeout, so it takes the longer of the two.
+        private void RecordTimings(RecognitionEngine e, RecognitionResult result) {
+            if (!adaptiveTimeouts) {
+                return;
+            }
+
+            string grammarClass = GetTimingClass(e, result.Grammar);
+            UtteranceTimings timings;
+            if (!timingsByClass.TryGetValue(grammarClass, out timings)) {
+                timings = new UtteranceTimings(grammarClass);
+                timingsByClass.Add(grammarClass, timings);
+            }
+            VoiceActivityGate.GatedAudioStream inputStream = e.inputStream;
+            timings.Record(result, inputStream == null ? (TimeSpan?)null : inputStream.WrittenTime);
+
+            if (++e.samplesSinceAdapted < ADAPT_INTERVAL) {
+                return;
+            }
+            List<UtteranceTimings> adaptable = e.timingClasses
+                .Where((x) => timingsByClass.ContainsKey(x) && timingsByClass[x].Count >= ADAPT_MIN_SAMPLES)
+                .Select((x) => timingsByClass[x]).ToList();
+            if (adaptable.Count == 0) {
+                return;
+            }
+            e.samplesSinceAdapted = 0;
+
+            foreach (UtteranceTimings t in adaptable) {
+                t.PrintToTrace();
+            }
+            double gap = adaptable.Max((x) => x.LongestGapPercentile(0.95)) + ADAPT_MARGIN_MS;
+            gap = Math.Max(e.minEndSilenceTimeoutAmbiguous.TotalMilliseconds, Math.Min(gap, e.maxEndSilenceTimeoutAmbiguous.TotalMilliseconds));
+            e.endSilenceTimeoutAmbiguous = TimeSpan.FromMilliseconds(Math.Round(gap));
+            ApplyTimeouts(e);
+        }
+
+        private string GetTimingClass(RecognitionEngine e, Grammar grammar) {
+            ISpeechRecognitionGrammarProvider provider = e.grammarProviders == null ? null :
+                e.grammarProviders.FirstOrDefault((x) => x.GetGrammars().Contains(grammar));
+            if (provider is FavoritesList) {
+                return TIMING_CLASS_FAVORITES;
+            }
+            if (provider is DialogueList || e == dialogueEngine) {
+                return TIMING_CLASS_DIALOGUE;
+            }
+            return TIMING_CLASS_COMMANDS;
         }
 
         private void WaitRecordingDeviceNonBlocking() {
@@ -99,6 +292,43 @@ namespace DSN {
             waitingDeviceThread.Start();
         }
 
+        private void SetInputToDefaultAudioDevice() {
+            if (useVoiceActivityGate) {
+                if (voiceActivityGate != null) {
+                    voiceActivityGate.Dispose();
+                    voiceActivityGate = null;
+                }
+
+                // One capture, each engine reads its own copy of the gated audio.
+                // The gate is kept only once both engines read from it, a failed setup stops the capture.
+                VoiceActivityGate gate = new VoiceActivityGate(voiceGateThreshold, voiceGatePreRoll, voiceGateHangover);
+                try {
+                    gate.Start();
+                    SetInputToGatedStream(commandEngine, gate.CreateStream());
+                    SetInputToGatedStream(dialogueEngine, gate.CreateStream());
+                } catch {
+                    // Closes the streams, the caller retries with a new input
+                    gate.Dispose();
+                    commandEngine.inputStream = null;
+                    dialogueEngine.inputStream = null;
+                    throw;
+                }
+                voiceActivityGate = gate;
+                return;
+            }
+
+            // Each engine opens the default device in shared mode
+            this.commandEngine.inputStream = null;
+            this.dialogueEngine.inputStream = null;
+            this.commandEngine.engine.SetInputToDefaultAudioDevice();
+            this.dialogueEngine.engine.SetInputToDefaultAudioDevice();
+        }
+
+        private void SetInputToGatedStream(RecognitionEngine e, VoiceActivityGate.GatedAudioStream stream) {
+            e.engine.SetInputToAudioStream(stream, VoiceActivityGate.FORMAT);
+            e.inputStream = stream;
+        }
+
         private void DoWaitRecordingDevice() {
             lock (dsnLock) {
                 StopRecognition();
@@ -107,13 +337,13 @@ namespace DSN {
 
             // Select input device
             try {
-                this.DSN.SetInputToDefaultAudioDevice();
+                SetInputToDefaultAudioDevice();
                 Trace.TraceInformation("Recording device is ready.");
             } catch {
                 Trace.TraceInformation("Waiting for recording device...");
                 while (config.IsRunning()) {
                     try {
-                        this.DSN.SetInputToDefaultAudioDevice();
+                        SetInputToDefaultAudioDevice();
                         Trace.TraceInformation("Recording device is ready.");
                         break;
                     } catch {
@@ -148,11 +378,25 @@ namespace DSN {
                 if (waitingDeviceThread != null) {
                     waitingDeviceThread.Abort();
                 }
+
+                cpuUsageTimer.Dispose();
+                if (voiceActivityGate != null) {
+                    voiceActivityGate.Dispose();
+                    voiceActivityGate = null;
+                }
             }
         }
 
+        // Start the stopped engines, the running ones only switch their grammars
         private void RestartRecognition() {
-            StartSpeechRecognition(isDialogueMode, grammarProviders);
+            lock (dsnLock) {
+                if (recognitionStatus == STATUS_WAITING_DEVICE) {
+                    return;
+                }
+                UpdateEngine(commandEngine);
+                UpdateEngine(dialogueEngine);
+                recognitionStatus = STATUS_RECOGNIZING;
+            }
         }
 
         private void DSN_AudioStateChanged(object sender, AudioStateChangedEventArgs e) {
@@ -167,11 +411,21 @@ namespace DSN {
             }
         }
 
+        private void StopEngine(RecognitionEngine e) {
+            if (e.isRecognizing) {
+                e.engine.RecognizeAsyncCancel();
+                e.isRecognizing = false;
+            }
+            e.pendingGrammars = null;
+            e.pendingKeptGrammars = null;
+        }
+
         public void StopRecognition() {
             lock (dsnLock) {
                 try {
+                    StopEngine(commandEngine);
+                    StopEngine(dialogueEngine);
                     if (recognitionStatus == STATUS_RECOGNIZING) {
-                        this.DSN.RecognizeAsyncCancel();
                         recognitionStatus = STATUS_STOPPED;
                     }
                 } catch (Exception e) {
@@ -181,42 +435,60 @@ namespace DSN {
             }
         }
 
-        public void StartSpeechRecognition(bool isDialogueMode, params ISpeechRecognitionGrammarProvider[] grammarProviders) {
+        // Change the grammars of a mode without switching to it
+        public void UpdateGrammars(bool isDialogueMode, params ISpeechRecognitionGrammarProvider[] grammarProviders) {
             lock (dsnLock) {
                 try {
-                    this.isDialogueMode = isDialogueMode;
-                    this.grammarProviders = grammarProviders;
+                    RecognitionEngine e = isDialogueMode ? dialogueEngine : commandEngine;
+                    e.grammarProviders = grammarProviders;
 
                     if (recognitionStatus == STATUS_WAITING_DEVICE) {
-                        // Avoid blocking and the program cannot quit when Skyrim is terminated
-                        Trace.TraceInformation("Recording device is not ready");
                         return;
                     }
+                    UpdateEngine(e);
+                    recognitionStatus = STATUS_RECOGNIZING;
+                } catch (Exception ex) {
+                    Trace.TraceError("Failed to update grammars due to exception");
+                    Trace.TraceError(ex.ToString());
+                }
+            }
+        }
 
-                    StopRecognition(); // Cancel previous recognition
+        public void StartSpeechRecognition(bool isDialogueMode, params ISpeechRecognitionGrammarProvider[] grammarProviders) {
+            lock (dsnLock) {
+                try {
+                    Stopwatch watch = Stopwatch.StartNew();
+                    this.isDialogueMode = isDialogueMode;
+                    speculativeGrammar = null;
 
-                    List<Grammar> allGrammars = new List<Grammar>();
-                    if (isPaused) {
-                        allGrammars.AddRange(resumePhrases);
+                    if (isDialogueMode) {
+                        dialogueEngine.grammarProviders = grammarProviders;
                     } else {
-                        if (grammarProviders != null) {
-                            allGrammars.AddRange(grammarProviders.SelectMany((x) => x.GetGrammars()).ToList());
-                        }
-                        allGrammars.AddRange(pausePhrases);
+                        commandEngine.grammarProviders = grammarProviders;
+                        // Drop the lines of the finished dialogue, the dialogue engine keeps listening to the pause phrases
+                        dialogueEngine.grammarProviders = null;
                     }
-                    // Error is thrown if no grammars are loaded
-                    if (allGrammars.Count > 0) {
-                        SetGrammar(allGrammars);
-                        this.DSN.RecognizeAsync(RecognizeMode.Multiple);
-                        recognitionStatus = STATUS_RECOGNIZING;
-
-                        Trace.TraceInformation(
-                            "Recognition {0}: {1} mode, {2} phrases",
-                            isPaused ? "paused" : "started",
-                            isDialogueMode ? "dialogue" : "command",
-                            allGrammars.Count
-                        );
+
+                    if (recognitionStatus == STATUS_WAITING_DEVICE) {
+                        // Avoid blocking and the program cannot quit when Skyrim is terminated
+                        Trace.TraceInformation("Recording device is not ready");
+                        return;
                     }
+
+                    // The engine of the new mode is updated first, the other one only disables its grammars
+                    RecognitionEngine active = isDialogueMode ? dialogueEngine : commandEngine;
+                    RecognitionEngine inactive = isDialogueMode ? commandEngine : dialogueEngine;
+                    UpdateEngine(active);
+                    long switchTime = watch.ElapsedMilliseconds;
+                    UpdateEngine(inactive);
+                    recognitionStatus = STATUS_RECOGNIZING;
+
+                    Trace.TraceInformation(
+                        "Recognition {0}: {1} mode, switch requested in {2} ms",
+                        isPaused ? "paused" : "started",
+                        isDialogueMode ? "dialogue" : "command",
+                        switchTime
+                    );
                 } catch (Exception e) {
                     Trace.TraceError("Failed to start new phrase recognition due to exception");
                     Trace.TraceError(e.ToString());
@@ -224,28 +496,203 @@ namespace DSN {
             }
         }
 
-        private void SetGrammar(List<Grammar> grammars) {
-            this.DSN.RequestRecognizerUpdate();
-            this.DSN.UnloadAllGrammars();
-            foreach (Grammar grammar in grammars) {
+        // Load the requested grammars into the engine. A running engine is never stopped, the grammars are
+        // switched in DSN_RecognizerUpdateReached while the engine waits, so no audio is lost during the switch.
+        // Only the engine of the current mode has grammars enabled. The other one keeps its grammars loaded but
+        // disabled, so it has nothing to search and switching back only enables them again.
+        private void UpdateEngine(RecognitionEngine e) {
+            bool isActive = e == (isDialogueMode ? dialogueEngine : commandEngine);
+
+            HashSet<Grammar> keptGrammars = new HashSet<Grammar>(e.pausePhrases.Concat(e.resumePhrases));
+            if (e.grammarProviders != null) {
+                keptGrammars.UnionWith(e.grammarProviders.SelectMany((x) => x.GetGrammars()));
+            }
+
+            HashSet<Grammar> requestedGrammars = new HashSet<Grammar>();
+            if (isActive) {
+                if (isPaused) {
+                    requestedGrammars.UnionWith(e.resumePhrases);
+                } else {
+                    requestedGrammars.UnionWith(keptGrammars.Except(e.resumePhrases));
+                }
+            }
+            // A running engine must keep a grammar loaded, there is nothing to keep without any phrase
+            if (e.isRecognizing && keptGrammars.Count == 0) {
+                keptGrammars.UnionWith(e.loadedGrammars);
+            }
+
+            if (e.isRecognizing) {
+                bool isUnchanged = e.loadedGrammars.All((x) => x.Enabled == requestedGrammars.Contains(x) && keptGrammars.Contains(x)) &&
+                    keptGrammars.All((x) => e.loadedGrammars.Contains(x));
+                if (isUnchanged && e.pendingGrammars == null) {
+                    return;
+                }
+                // The latest request wins if several are made before the engine reaches the update
+                e.pendingGrammars = requestedGrammars;
+                e.pendingKeptGrammars = keptGrammars;
+                e.pendingWatch.Restart();
+                e.engine.RequestRecognizerUpdate(e);
+                if (e.inputStream != null) {
+                    // The gated stream may be idle, the update is only reached while audio is processed
+                    e.inputStream.Nudge();
+                }
+                return;
+            }
+
+            // Error is thrown if no grammars are loaded
+            if (keptGrammars.Count > 0) {
+                SetGrammar(e, requestedGrammars, keptGrammars);
+                e.engine.RecognizeAsync(RecognizeMode.Multiple);
+                e.isRecognizing = true;
+            }
+        }
+
+        // Raised on the engine's thread while it waits, grammars can be loaded and unloaded without stopping it.
+        // The audio received meanwhile is buffered and recognized with the new grammars.
+        private void DSN_RecognizerUpdateReached(object sender, RecognizerUpdateReachedEventArgs args) {
+            lock (dsnLock) {
+                RecognitionEngine e = args.UserToken as RecognitionEngine;
+                if (e == null || e.pendingGrammars == null) {
+                    return;
+                }
+                try {
+                    SetGrammar(e, e.pendingGrammars, e.pendingKeptGrammars);
+                    Trace.TraceInformation("{0} grammars switched {1} ms after the request", e.name, e.pendingWatch.ElapsedMilliseconds);
+                } catch (Exception ex) {
+                    Trace.TraceError("Failed to switch {0} grammars due to exception:\n{1}", e.name, ex.ToString());
+                }
+                e.pendingGrammars = null;
+                e.pendingKeptGrammars = null;
+            }
+        }
+
+        // Enable the requested grammars and disable the other kept ones, loading them if needed.
+        // The requested grammars are a subset of the kept ones, any other loaded grammar is unloaded.
+        private void SetGrammar(RecognitionEngine e, HashSet<Grammar> requestedGrammars, HashSet<Grammar> keptGrammars) {
+            Stopwatch watch = Stopwatch.StartNew();
+            int loadedCount = 0, unloadedCount = 0, disabledCount = 0;
+
+            foreach (Grammar grammar in e.loadedGrammars.Where((x) => !keptGrammars.Contains(x)).ToList()) {
+                try {
+                    e.engine.UnloadGrammar(grammar);
+                } catch (Exception ex) {
+                    Trace.TraceError("Unload grammar '{0}' failed:\n{1}", grammar.Name, ex.ToString());
+                }
+                e.loadedGrammars.Remove(grammar);
+                unloadedCount++;
+            }
+
+            foreach (Grammar grammar in keptGrammars) {
+                bool isEnabled = requestedGrammars.Contains(grammar);
+                if (e.loadedGrammars.Contains(grammar)) {
+                    if (grammar.Enabled && !isEnabled) {
+                        disabledCount++;
+                    }
+                    grammar.Enabled = isEnabled;
+                    continue;
+                }
                 try {
-                    this.DSN.LoadGrammar(grammar);
+                    grammar.Enabled = isEnabled;
+                    e.engine.LoadGrammar(grammar);
+                    e.loadedGrammars.Add(grammar);
+                    loadedCount++;
                 } catch (Exception ex) {
                     Trace.TraceError("Load grammar '{0}' failed:\n{1}", grammar.Name, ex.ToString());
                 }
             }
+
+            Trace.TraceInformation("{0} grammars switched in {1} ms: {2} loaded, {3} unloaded, {4} disabled, {5} active",
+                e.name, watch.ElapsedMilliseconds, loadedCount, unloadedCount, disabledCount, requestedGrammars.Count);
         }
 
         private void DSN_SpeechRecognitionRejected(object sender, SpeechRecognitionRejectedEventArgs e) {
-            // nothing to do
+            lock (dsnLock) {
+                if (speculativeGrammar != null && sender == commandEngine.engine) {
+                    Trace.TraceInformation("Phrase '{0}' was dispatched from its hypothesis but the recognition was rejected", speculativeGrammar.Name);
+                    speculativeGrammar = null;
+                }
+
+                // Also the phrases that were cut by a too short timeout
+                RecognitionEngine active = isDialogueMode ? dialogueEngine : commandEngine;
+                if (sender == active.engine && e.Result != null && e.Result.Words.Count > 0) {
+                    RecordTimings(active, e.Result);
+                }
+            }
+        }
+
+        private void DSN_SpeechHypothesized(object sender, SpeechHypothesizedEventArgs e) {
+            lock (dsnLock) {
+                // Only commands, one per utterance
+                if (isPaused || isDialogueMode || sender != commandEngine.engine || speculativeGrammar != null) {
+                    return;
+                }
+
+                RecognitionResult result = e.Result;
+                if (result.Grammar == null || result.Confidence < speculativeMinimumConfidence || IsPauseOrResumePhrase(commandEngine, result.Grammar)) {
+                    return;
+                }
+                // Another grammar is still a candidate
+                if (result.Alternates.Any((x) => x.Grammar != result.Grammar)) {
+                    return;
+                }
+                if (!IsCompleteHypothesis(commandEngine, result)) {
+                    return;
+                }
+
+                speculativeGrammar = result.Grammar;
+                speculativeWatch.Restart();
+                Trace.TraceInformation("Hypothesized phrase '{0}' dispatched early (Confidence: {1})", result.Text, result.Confidence);
+                OnDialogueLineRecognized?.Invoke(result);
+            }
+        }
+
+        // A whole phrase of its provider that no grammar loaded in the engine can extend,
+        // such as "stop" while "stop listening" is a pause phrase.
+        private bool IsCompleteHypothesis(RecognitionEngine e, RecognitionResult result) {
+            if (e.grammarProviders == null) {
+                return false;
+            }
+
+            string text = Phrases.normalize(result.Text, config);
+            if (!e.grammarProviders.Any((x) => x.IsCompletePhrase(result, text))) {
+                return false;
+            }
+            if (e.pausePhraseStrings.Concat(e.resumePhraseStrings).Any((x) => Phrases.canExtend(x, text, config))) {
+                return false;
+            }
+            return !e.grammarProviders.Any((x) => x.CanExtend(text));
+        }
+
+        private bool IsPauseOrResumePhrase(RecognitionEngine e, Grammar grammar) {
+            return e.pausePhrases.Contains(grammar) || e.resumePhrases.Contains(grammar);
         }
 
         private void DSN_SpeechRecognized(object sender, SpeechRecognizedEventArgs e) {
             lock (dsnLock) {
-                if (pausePhrases.Contains(e.Result.Grammar) || resumePhrases.Contains(e.Result.Grammar)) {
-                    if (e.Result.Confidence >= commandMinimumConfidence) {
-                        StopRecognition();
+                // Results of the engine of the other mode are not used, it can still finish
+                // an utterance it started before its grammars were disabled.
+                RecognitionEngine active = isDialogueMode ? dialogueEngine : commandEngine;
+                if (sender != active.engine) {
+                    return;
+                }
 
+                if (speculativeGrammar != null) {
+                    Grammar dispatched = speculativeGrammar;
+                    speculativeGrammar = null;
+                    if (e.Result.Grammar == dispatched) {
+                        RecordTimings(active, e.Result);
+                        long savedMilliseconds = speculativeWatch.ElapsedMilliseconds;
+                        speculativeCount++;
+                        speculativeSavedMilliseconds += savedMilliseconds;
+                        Trace.TraceInformation("Recognized phrase '{0}' was dispatched {1} ms earlier from its hypothesis (average {2} ms over {3} commands)",
+                            e.Result.Text, savedMilliseconds, speculativeSavedMilliseconds / speculativeCount, speculativeCount);
+                        return;
+                    }
+                    Trace.TraceInformation("Recognized phrase '{0}' differs from the early dispatched '{1}'", e.Result.Text, dispatched.Name);
+                }
+
+                if (IsPauseOrResumePhrase(active, e.Result.Grammar)) {
+                    if (e.Result.Confidence >= commandMinimumConfidence) {
                         isPaused = !isPaused;
                         Trace.TraceInformation("****** Recognition {0} ******", isPaused ? "Paused" : "Resumed");
 
@@ -270,8 +717,10 @@ namespace DSN {
                 if (e.Result.Confidence >= minConfidence) {
                     Trace.TraceInformation("Recognized phrase '{0}' (Confidence: {1})", e.Result.Text, e.Result.Confidence);
                     OnDialogueLineRecognized?.Invoke(e.Result);
+                    RecordTimings(active, e.Result);
                 } else {
                     Trace.TraceInformation("Recognized phrase '{0}' but ignored because confidence was too low (Confidence: {1})", e.Result.Text, e.Result.Confidence);
+                    RecordTimings(active, e.Result);
                 }
             }
         }
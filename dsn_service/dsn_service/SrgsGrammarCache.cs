@@ -0,0 +1,147 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Diagnostics;
+using System.IO;
+using System.Security.Cryptography;
+using System.Speech.Recognition;
+using System.Speech.Recognition.SrgsGrammar;
+using System.Threading;
+using System.Xml;
+
+namespace DSN {
+    // Compiles SRGS XML grammars to .cfg files in My Documents, keyed by the file content and locale.
+    // Loading a compiled grammar skips parsing and compiling large XML files on every start.
+    static class SrgsGrammarCache {
+        private static readonly string CACHE_DIR = Configuration.MY_DOCUMENT_DSN_DIR + "GrammarCache\\";
+
+        // Compiled grammars that weren't used for this long belong to changed or removed files
+        private static readonly TimeSpan MAX_UNUSED_AGE = TimeSpan.FromDays(30);
+
+        // Grammars are loaded from several threads
+        private static int hits = 0;
+        private static int misses = 0;
+        private static int isPruned = 0;
+        private static readonly ConcurrentDictionary<string, object> keyLocks = new ConcurrentDictionary<string, object>();
+
+        public static int Hits { get { return hits; } }
+        public static int Misses { get { return misses; } }
+
+        public static Grammar Load(string path, Configuration config) {
+            if (Interlocked.Exchange(ref isPruned, 1) == 0) {
+                Prune();
+            }
+
+            byte[] content = File.ReadAllBytes(path);
+            string cacheKey = GetCacheKey(content, config.GetLocale().Name);
+            string cfgPath = CACHE_DIR + cacheKey + ".cfg";
+
+            // Commands using the same file compile it once, and the file is never replaced while another thread reads it
+            lock (keyLocks.GetOrAdd(cacheKey, k => new object())) {
+                if (File.Exists(cfgPath)) {
+                    try {
+                        Grammar cached = ReadCompiled(cfgPath);
+                        // Last access times are often not maintained, so mark the file as used for pruning
+                        File.SetLastWriteTimeUtc(cfgPath, DateTime.UtcNow);
+                        Interlocked.Increment(ref hits);
+                        return cached;
+                    } catch (Exception ex) {
+                        Trace.TraceError("Failed to load the compiled grammar {0}, compile it again:\n{1}", cfgPath, ex.ToString());
+                    }
+                }
+
+                Interlocked.Increment(ref misses);
+                MemoryStream xmlStream = LocalizeXml(content, config);
+                string tempPath = cfgPath + "." + Guid.NewGuid().ToString("N") + ".tmp";
+                try {
+                    Directory.CreateDirectory(CACHE_DIR);
+
+                    // Write to a temporary file first, so an interrupted compile doesn't leave a broken cache
+                    using (FileStream cfgStream = new FileStream(tempPath, FileMode.Create)) {
+                        SrgsGrammarCompiler.Compile(XmlReader.Create(xmlStream), cfgStream);
+                    }
+                    if (File.Exists(cfgPath)) {
+                        // The cached file failed to load above
+                        File.Replace(tempPath, cfgPath, null);
+                    } else {
+                        File.Move(tempPath, cfgPath);
+                    }
+
+                    return ReadCompiled(cfgPath);
+                } catch (Exception ex) {
+                    Trace.TraceError("Failed to compile the grammar {0}, load it without caching:\n{1}", path, ex.ToString());
+                    TryDelete(tempPath);
+                }
+
+                xmlStream.Position = 0;
+                return new Grammar(xmlStream);
+            }
+        }
+
+        // Grammar(path) opens the file again in LoadGrammar(), so read it into memory while holding the key's lock
+        private static Grammar ReadCompiled(string cfgPath) {
+            return new Grammar(new MemoryStream(File.ReadAllBytes(cfgPath)));
+        }
+
+        // Removes compiled grammars that weren't used for a long time and temporary files left by a crash.
+        // Runs before the first load, so no other thread is using the files.
+        private static void Prune() {
+            try {
+                if (!Directory.Exists(CACHE_DIR)) {
+                    return;
+                }
+
+                DateTime now = DateTime.UtcNow;
+                int count = 0;
+                foreach (string file in Directory.GetFiles(CACHE_DIR)) {
+                    bool isTemp = file.EndsWith(".tmp", StringComparison.OrdinalIgnoreCase);
+                    if (!isTemp && !file.EndsWith(".cfg", StringComparison.OrdinalIgnoreCase)) {
+                        continue;
+                    }
+                    if (isTemp || now - File.GetLastWriteTimeUtc(file) > MAX_UNUSED_AGE) {
+                        if (TryDelete(file)) {
+                            count++;
+                        }
+                    }
+                }
+                if (count > 0) {
+                    Trace.TraceInformation("Removed {0} unused files from the grammar cache", count);
+                }
+            } catch (Exception ex) {
+                Trace.TraceError("Failed to prune the grammar cache:\n{0}", ex.ToString());
+            }
+        }
+
+        private static bool TryDelete(string file) {
+            try {
+                File.Delete(file);
+                return true;
+            } catch (Exception) {
+                return false;
+            }
+        }
+
+        private static string GetCacheKey(byte[] content, string locale) {
+            using (SHA1 sha1 = SHA1.Create()) {
+                byte[] hash = sha1.ComputeHash(content);
+                return BitConverter.ToString(hash).Replace("-", "").ToLower() + "." + locale;
+            }
+        }
+
+        private static MemoryStream LocalizeXml(byte[] content, Configuration config) {
+            // load a SRGS XML file
+            XmlDocument doc = new XmlDocument();
+            doc.Load(new MemoryStream(content));
+
+            // If xml:lang in the file does not match the DSN's locale, the grammar cannot be loaded.
+            XmlAttribute xmlLang = doc.CreateAttribute("xml:lang");
+            xmlLang.Value = config.GetLocale().Name;
+            doc.DocumentElement.SetAttributeNode(xmlLang);
+
+            MemoryStream xmlStream = new MemoryStream();
+            doc.Save(xmlStream);
+            xmlStream.Flush();
+            xmlStream.Position = 0;
+            return xmlStream;
+        }
+    }
+}
@@ -0,0 +1,89 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Speech.Recognition;
+
+namespace DSN {
+    // Timing distributions of the recent recognized utterances of one grammar class (commands, favorites, dialogue).
+    // The ambiguous end silence timeout of the engine recognizing the class is tuned from them.
+    class UtteranceTimings {
+        private const int CAPACITY = 200;
+
+        public readonly string name;
+        // Longest pause between two words of each utterance, in ms
+        private readonly Queue<double> longestGaps = new Queue<double>();
+        private readonly Queue<double> durations = new Queue<double>();
+        // From the end of the speech to the result, in ms
+        private readonly Queue<double> latencies = new Queue<double>();
+
+        public UtteranceTimings(string name) {
+            this.name = name;
+        }
+
+        public int Count {
+            get { return durations.Count; }
+        }
+
+        // streamTime: end of the audio written to the engine's input stream, null when the engine reads the device directly
+        public void Record(RecognitionResult result, TimeSpan? streamTime) {
+            RecognizedAudio audio = result.Audio;
+            if (audio == null) {
+                return;
+            }
+
+            double longestGap = 0;
+            try {
+                for (int i = 0; i + 1 < result.Words.Count; i++) {
+                    RecognizedAudio word = result.GetAudioForWordRange(result.Words[i], result.Words[i]);
+                    RecognizedAudio nextWord = result.GetAudioForWordRange(result.Words[i + 1], result.Words[i + 1]);
+                    double gap = (nextWord.AudioPosition - (word.AudioPosition + word.Duration)).TotalMilliseconds;
+                    longestGap = Math.Max(longestGap, gap);
+                }
+            } catch (Exception ex) {
+                Trace.TraceError("Failed to get the word timings of '{0}':\n{1}", result.Text, ex.ToString());
+                return;
+            }
+
+            Add(longestGaps, longestGap);
+            Add(durations, audio.Duration.TotalMilliseconds);
+            double latency;
+            if (streamTime.HasValue) {
+                // The voice gate skips silence, so StartTime drifts from the clock.
+                // Positions are offsets in the engine's input stream, compare them with the audio written to it.
+                latency = (streamTime.Value - (audio.AudioPosition + audio.Duration)).TotalMilliseconds;
+            } else {
+                latency = (DateTime.Now - (audio.StartTime + audio.Duration)).TotalMilliseconds;
+            }
+            Add(latencies, latency);
+        }
+
+        public void PrintToTrace() {
+            Trace.TraceInformation("{0} timings over {1} utterances: longest gap p50 {2:0} ms p95 {3:0} ms, duration p50 {4:0} ms p95 {5:0} ms, latency p50 {6:0} ms p95 {7:0} ms",
+                name, Count,
+                Percentile(longestGaps, 0.5), Percentile(longestGaps, 0.95),
+                Percentile(durations, 0.5), Percentile(durations, 0.95),
+                Percentile(latencies, 0.5), Percentile(latencies, 0.95));
+        }
+
+        private static void Add(Queue<double> samples, double value) {
+            if (samples.Count == CAPACITY) {
+                samples.Dequeue();
+            }
+            samples.Enqueue(value);
+        }
+
+        private static double Percentile(IEnumerable<double> samples, double percentile) {
+            double[] sorted = samples.OrderBy((x) => x).ToArray();
+            if (sorted.Length == 0) {
+                return 0;
+            }
+            int index = (int)Math.Ceiling(percentile * sorted.Length) - 1;
+            return sorted[Math.Max(0, Math.Min(index, sorted.Length - 1))];
+        }
+
+        public double LongestGapPercentile(double percentile) {
+            return Percentile(longestGaps, percentile);
+        }
+    }
+}
@@ -0,0 +1,261 @@
+﻿using NAudio.Wave;
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Speech.AudioFormat;
+using System.Threading;
+
+namespace DSN {
+    // Captures the default recording device and passes the audio to the recognition engines only while someone speaks.
+    // The engines block on an empty stream instead of processing silence.
+    class VoiceActivityGate : IDisposable {
+        private const int SAMPLE_RATE = 16000;
+        private const int BYTES_PER_MS = SAMPLE_RATE * 2 / 1000; // 16 bit mono
+        private const int FRAME_MS = 20;
+        // How much louder than the background noise speech must be
+        private const double OPEN_RATIO = 3.0;
+        // An engine that doesn't read for this long drops the oldest audio
+        private const int MAX_QUEUED_MS = 5000;
+        // While the gate is closed, a frame of silence is passed this often. The engine only reaches
+        // a recognizer update while it processes audio, so grammar switches would wait for the next word.
+        private const int IDLE_SILENCE_INTERVAL_MS = 200;
+
+        public static readonly SpeechAudioFormatInfo FORMAT = new SpeechAudioFormatInfo(SAMPLE_RATE, AudioBitsPerSample.Sixteen, AudioChannel.Mono);
+
+        private readonly double minimumLevel;
+        private readonly int preRollBytes;
+        private readonly int hangoverMs;
+
+        private WaveInEvent waveIn;
+        private readonly List<GatedAudioStream> streams = new List<GatedAudioStream>();
+        private readonly Object streamsLock = new Object();
+
+        // Audio just before the gate opens, so the beginning of the first word is not cut
+        private readonly Queue<byte[]> preRoll = new Queue<byte[]>();
+        private int preRollLength = 0;
+
+        private bool isOpen = false;
+        private int silentMs = 0;
+        private double noiseLevel = -1;
+
+        private long capturedMs = 0;
+        private long passedMs = 0;
+
+        // minimumLevel: RMS level (0-1) below which audio is never speech
+        public VoiceActivityGate(double minimumLevel, int preRollMs, int hangoverMs) {
+            this.minimumLevel = minimumLevel;
+            this.preRollBytes = preRollMs * BYTES_PER_MS;
+            this.hangoverMs = hangoverMs;
+        }
+
+        // Throws if there is no recording device
+        public void Start() {
+            waveIn = new WaveInEvent();
+            waveIn.DeviceNumber = -1; // WAVE_MAPPER, follows the default device
+            waveIn.WaveFormat = new WaveFormat(SAMPLE_RATE, 16, 1);
+            waveIn.BufferMilliseconds = FRAME_MS;
+            waveIn.DataAvailable += WaveIn_DataAvailable;
+            waveIn.StartRecording();
+        }
+
+        // A stream for one engine, each engine reads all the passed audio
+        public GatedAudioStream CreateStream() {
+            GatedAudioStream stream = new GatedAudioStream(MAX_QUEUED_MS * BYTES_PER_MS);
+            lock (streamsLock) {
+                streams.Add(stream);
+            }
+            return stream;
+        }
+
+        // Fraction of the captured audio passed to the engines since the last call
+        public double TakeOpenRatio() {
+            long captured = Interlocked.Exchange(ref capturedMs, 0);
+            long passed = Interlocked.Exchange(ref passedMs, 0);
+            return captured == 0 ? 0 : (double)passed / captured;
+        }
+
+        public void Dispose() {
+            if (waveIn != null) {
+                waveIn.DataAvailable -= WaveIn_DataAvailable;
+                try {
+                    waveIn.StopRecording();
+                } catch (Exception ex) {
+                    Trace.TraceError("Failed to stop the audio capture:\n{0}", ex.ToString());
+                }
+                waveIn.Dispose();
+                waveIn = null;
+            }
+            lock (streamsLock) {
+                foreach (GatedAudioStream stream in streams) {
+                    stream.Close();
+                }
+                streams.Clear();
+            }
+        }
+
+        private void WaveIn_DataAvailable(object sender, WaveInEventArgs e) {
+            byte[] frame = new byte[e.BytesRecorded];
+            Buffer.BlockCopy(e.Buffer, 0, frame, 0, e.BytesRecorded);
+            int frameMs = frame.Length / BYTES_PER_MS;
+            Interlocked.Add(ref capturedMs, frameMs);
+
+            double level = GetLevel(frame);
+            bool isLoud = level > Math.Max(minimumLevel, noiseLevel * OPEN_RATIO);
+
+            if (!isOpen) {
+                // The background noise is only learned while nobody speaks
+                noiseLevel = noiseLevel < 0 ? level : noiseLevel * 0.95 + level * 0.05;
+
+                if (!isLoud) {
+                    preRoll.Enqueue(frame);
+                    preRollLength += frame.Length;
+                    while (preRollLength > preRollBytes && preRoll.Count > 0) {
+                        preRollLength -= preRoll.Dequeue().Length;
+                    }
+                    return;
+                }
+
+                isOpen = true;
+                while (preRoll.Count > 0) {
+                    byte[] preRollFrame = preRoll.Dequeue();
+                    Interlocked.Add(ref passedMs, preRollFrame.Length / BYTES_PER_MS);
+                    Write(preRollFrame);
+                }
+                preRollLength = 0;
+            }
+
+            // Keep passing the silence after speech for a while, the engines need it to detect the end of the phrase
+            silentMs = isLoud ? 0 : silentMs + frameMs;
+            if (silentMs > hangoverMs) {
+                isOpen = false;
+                silentMs = 0;
+            }
+            Interlocked.Add(ref passedMs, frameMs);
+            Write(frame);
+        }
+
+        private void Write(byte[] frame) {
+            lock (streamsLock) {
+                foreach (GatedAudioStream stream in streams) {
+                    stream.Enqueue(frame);
+                }
+            }
+        }
+
+        // RMS level of 16 bit samples, 0-1
+        private static double GetLevel(byte[] frame) {
+            int samples = frame.Length / 2;
+            if (samples == 0) {
+                return 0;
+            }
+            double sum = 0;
+            for (int i = 0; i < samples; i++) {
+                short sample = (short)(frame[2 * i] | (frame[2 * i + 1] << 8));
+                sum += (double)sample * sample;
+            }
+            return Math.Sqrt(sum / samples) / 32768.0;
+        }
+
+        // Blocking stream read by an engine. Returning 0 from Read would end the recognition,
+        // so Read waits for audio until the stream is closed, and returns silence while none comes.
+        public class GatedAudioStream : Stream {
+            private readonly Queue<byte[]> frames = new Queue<byte[]>();
+            private readonly Object queueLock = new Object();
+            private readonly int capacity;
+            private int queuedLength = 0;
+            // Read or still readable by the engine, dropped audio excluded
+            private long streamLength = 0;
+            private int offset = 0; // Already read from the first frame
+            private bool isClosed = false;
+            private bool isNudged = false;
+
+            public GatedAudioStream(int capacity) {
+                this.capacity = capacity;
+            }
+
+            // Stream offset of the newest audio, the engine reports its audio positions in the same time base
+            public TimeSpan WrittenTime {
+                get {
+                    lock (queueLock) {
+                        return TimeSpan.FromMilliseconds((double)streamLength / BYTES_PER_MS);
+                    }
+                }
+            }
+
+            public void Enqueue(byte[] frame) {
+                lock (queueLock) {
+                    frames.Enqueue(frame);
+                    queuedLength += frame.Length;
+                    streamLength += frame.Length;
+                    while (queuedLength > capacity && frames.Count > 1) {
+                        int dropped = frames.Dequeue().Length - offset;
+                        queuedLength -= dropped;
+                        streamLength -= dropped;
+                        offset = 0;
+                    }
+                    Monitor.PulseAll(queueLock);
+                }
+            }
+
+            // Pass a frame of silence now instead of waiting for the idle interval,
+            // so a requested recognizer update is reached right away
+            public void Nudge() {
+                lock (queueLock) {
+                    isNudged = true;
+                    Monitor.PulseAll(queueLock);
+                }
+            }
+
+            public override int Read(byte[] buffer, int bufferOffset, int count) {
+                lock (queueLock) {
+                    if (frames.Count == 0 && !isClosed && !isNudged) {
+                        Monitor.Wait(queueLock, IDLE_SILENCE_INTERVAL_MS);
+                    }
+                    if (frames.Count == 0 && !isClosed) {
+                        // Silence, counted in the stream like the passed audio
+                        isNudged = false;
+                        int length = Math.Min(count, FRAME_MS * BYTES_PER_MS);
+                        Array.Clear(buffer, bufferOffset, length);
+                        streamLength += length;
+                        return length;
+                    }
+
+                    int read = 0;
+                    while (read < count && frames.Count > 0) {
+                        byte[] frame = frames.Peek();
+                        int length = Math.Min(count - read, frame.Length - offset);
+                        Buffer.BlockCopy(frame, offset, buffer, bufferOffset + read, length);
+                        read += length;
+                        offset += length;
+                        queuedLength -= length;
+                        if (offset == frame.Length) {
+                            frames.Dequeue();
+                            offset = 0;
+                        }
+                    }
+                    return read;
+                }
+            }
+
+            public override void Close() {
+                lock (queueLock) {
+                    isClosed = true;
+                    Monitor.PulseAll(queueLock);
+                }
+                base.Close();
+            }
+
+            public override bool CanRead { get { return true; } }
+            public override bool CanSeek { get { return false; } }
+            public override bool CanWrite { get { return false; } }
+            // The engine queries these, a live stream has no length or position
+            public override long Length { get { return 0; } }
+            public override long Position { get { return 0; } set { } }
+            public override void Flush() { }
+            public override long Seek(long offset, SeekOrigin origin) { return 0; }
+            public override void SetLength(long value) { throw new NotSupportedException(); }
+            public override void Write(byte[] buffer, int offset, int count) { throw new NotSupportedException(); }
+        }
+    }
+}